@@ -0,0 +1,417 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <glob.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "lib/DimacsLoader.hpp"
+#include "lib/MatrixSnapshot.hpp"
+#include "lib/ResourceUsage.hpp"
+#include "lib/SparseMatrix.hpp"
+
+// Runs every engine over the bundled datasets and prints one JSON record
+// per (file, engine): median, p95 and best time over the repetitions,
+// GFLOP-equivalents, peak RSS and whether the result matched the
+// reference engine.
+//
+// Every run happens in a forked child, so the peak RSS belongs to that
+// engine alone and a crash or abort only loses its own record. References
+// are computed once per file by another child and passed on as snapshots.
+
+namespace {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct Options {
+  size_t warmup = 1;
+  size_t reps = 5;
+  size_t maxNodes = 10000;
+  std::string json;
+  std::string tmp = P_tmpdir;
+  pid_t owner = getpid(); // names the reference files shared with children
+  std::vector<std::string> files;
+};
+
+// Matrix as read from a dataset file: DIMACS arcs, or the dense text form
+// "<rows> <cols>" followed by the rows.
+struct Input {
+  std::string path;
+  bool dimacs = false;
+  size_t nodes = 0;
+};
+
+enum Kind { Closure, MinPlusProduct, Product };
+
+const char *kindName(Kind k) {
+  return k == Closure ? "closure"
+                      : (k == MinPlusProduct ? "minplus-product" : "product");
+}
+
+struct Engine {
+  std::string name;
+  Kind kind;
+  size_t maxNodes; // 0: only the global limit applies
+  bool powerOfTwo; // block recursion splits in halves
+  std::function<CSRMatrix<double>(const SparseMatrix<double> &, thread_pool &)>
+      run;
+};
+
+std::vector<Engine> engines() {
+  typedef SparseMatrix<double> M;
+  typedef MinPlus<double> MP;
+  std::vector<Engine> e;
+  e.push_back({"diamond", Closure, 0, false, [](const M &m, thread_pool &) {
+                 return M(m).diamond().toCSR();
+               }});
+  e.push_back({"diamondConcurrent", Closure, 0, false,
+               [](const M &m, thread_pool &p) {
+                 return m.diamondConcurrent(p).toCSR();
+               }});
+  e.push_back({"diamondSemiNaive", Closure, 0, false,
+               [](const M &m, thread_pool &p) {
+                 return m.diamondSemiNaive(p).toCSR();
+               }});
+  e.push_back({"closureSquaring", Closure, 0, false,
+               [](const M &m, thread_pool &p) {
+                 return m.closure<MP>(&p).toCSR();
+               }});
+  e.push_back({"closureDijkstra", Closure, 0, false,
+               [](const M &m, thread_pool &p) {
+                 return m.closureDijkstra<MP>(&p).toCSR();
+               }});
+  e.push_back({"closureDense", Closure, 4096, false,
+               [](const M &m, thread_pool &p) {
+                 return m.closureDense<MP>(&p).toCSR();
+               }});
+  e.push_back({"diamondSeq", MinPlusProduct, 2048, false,
+               [](const M &m, thread_pool &) {
+                 return m.diamondSeq(m).toCSR();
+               }});
+  e.push_back({"diamond_block_seq", MinPlusProduct, 1024, true,
+               [](const M &m, thread_pool &) {
+                 M b(m);
+                 return m.diamond_block_seq(b).toCSR();
+               }});
+  e.push_back({"operator*", Product, 0, false, [](const M &m, thread_pool &) {
+                 return (M(m) * m).toCSR();
+               }});
+  e.push_back({"multConcurrent", Product, 0, false,
+               [](const M &m, thread_pool &p) {
+                 return M(m).multConcurrent(m, p).toCSR();
+               }});
+  e.push_back({"multMatrix", Product, 2048, false,
+               [](const M &m, thread_pool &) {
+                 return M(m).multMatrix(m).toCSR();
+               }});
+  e.push_back({"mult_block_seq", Product, 1024, true,
+               [](const M &m, thread_pool &) {
+                 return M(m).mult_block_seq(m).toCSR();
+               }});
+  return e;
+}
+
+bool applies(const Engine &e, const Input &in, const Options &opt) {
+  size_t n = in.nodes;
+  if (n == 0 || n > opt.maxNodes || (e.maxNodes && n > e.maxNodes))
+    return false;
+  return !e.powerOfTwo || (n & (n - 1)) == 0;
+}
+
+// Reads just enough of a file to know its format and size.
+bool probe(const std::string &path, Input &in) {
+  std::ifstream f(path);
+  std::string line;
+  in.path = path;
+  while (std::getline(f, line)) {
+    std::istringstream s(line);
+    std::string tag;
+    if (!(s >> tag) || tag == "c")
+      continue;
+    if (tag == "p") {
+      std::string sp;
+      in.dimacs = true;
+      return static_cast<bool>(s >> sp >> in.nodes) && sp == "sp";
+    }
+    size_t cols = 0;
+    in.nodes = std::strtoul(tag.c_str(), nullptr, 10);
+    return static_cast<bool>(s >> cols) && cols == in.nodes;
+  }
+  return false;
+}
+
+SparseMatrix<double> load(const Input &in, thread_pool &pool) {
+  if (in.dimacs)
+    return loadDimacs<double>(in.path, pool);
+  std::ifstream f(in.path);
+  size_t r, c;
+  f >> r >> c;
+  std::vector<Triplet<double>> t;
+  for (size_t i = 0; i < r; i++) {
+    for (size_t j = 0; j < c; j++) {
+      double v;
+      if (!(f >> v))
+        throw std::runtime_error(in.path + " is truncated");
+      if (v != 0)
+        t.push_back({i, j, v});
+    }
+  }
+  return SparseMatrix<double>::fromTriplets(r, c, std::move(t), &pool);
+}
+
+// Work of one run in floating-point operations: two per partial product
+// for the products, 2 n^3 (dense Floyd-Warshall) for the closures, so
+// closure engines compare on one scale whatever they do internally.
+double flops(Kind kind, const CSRMatrix<double> &a) {
+  if (kind == Closure) {
+    double n = a.getNumRows();
+    return 2 * n * n * n;
+  }
+  double products = 0;
+  for (size_t p = 0; p < a.nnz(); p++)
+    products += a.rowSize(a.col(p));
+  return 2 * products;
+}
+
+bool sameResult(const CSRMatrix<double> &x, const CSRMatrix<double> &y) {
+  if (x.getNumRows() != y.getNumRows() || x.nnz() != y.nnz())
+    return false;
+  if (!std::equal(x.getRowPtr(), x.getRowPtr() + x.getNumRows() + 1,
+                  y.getRowPtr()) ||
+      !std::equal(x.getColIdx(), x.getColIdx() + x.nnz(), y.getColIdx()))
+    return false;
+  for (size_t p = 0; p < x.nnz(); p++) {
+    double a = x.value(p), b = y.value(p);
+    if (std::fabs(a - b) > 1e-9 * std::max(std::fabs(a), std::fabs(b)))
+      return false;
+  }
+  return true;
+}
+
+std::string referencePath(const Options &opt, Kind kind) {
+  return opt.tmp + "/bench-" + std::to_string(opt.owner) + "-" +
+         kindName(kind) + ".snap";
+}
+
+// Reference results: Floyd-Warshall (or semi-naive past 4096 nodes) for
+// closures, the dense tile kernel (or sparse Gustavson past 2048 nodes)
+// for products.
+void writeReferences(const Input &in, const Options &opt) {
+  thread_pool pool;
+  SparseMatrix<double> m = load(in, pool);
+  typedef MinPlus<double> MP;
+  typedef PlusTimes<double> PT;
+  bool small = in.nodes <= 2048;
+  saveSnapshot(in.nodes <= 4096 ? m.closureDense<MP>(&pool)
+                                : m.closureSemiNaive<MP>(&pool),
+               referencePath(opt, Closure));
+  saveSnapshot(small ? m.multiplyDense<MP>(m) : m.multiply<MP>(m, &pool),
+               referencePath(opt, MinPlusProduct));
+  saveSnapshot(small ? m.multiplyDense<PT>(m) : m.multiply<PT>(m, &pool),
+               referencePath(opt, Product));
+}
+
+std::string jsonString(const std::string &s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+// Child side of one (file, engine) run; returns its JSON record.
+std::string runEngine(const Input &in, const Engine &e, const Options &opt) {
+  thread_pool pool;
+  SparseMatrix<double> m = load(in, pool);
+  CSRMatrix<double> a = m.toCSR();
+
+  CSRMatrix<double> result;
+  for (size_t w = 0; w < opt.warmup; w++)
+    result = e.run(m, pool);
+  std::vector<double> times;
+  for (size_t r = 0; r < opt.reps; r++) {
+    auto start = Clock::now();
+    result = e.run(m, pool);
+    times.push_back(std::chrono::duration_cast<std::chrono::duration<double>>(
+                        Clock::now() - start)
+                        .count());
+  }
+  // before the reference is mapped in
+  size_t rss = peakRSSBytes();
+
+  std::sort(times.begin(), times.end());
+  double median = times[times.size() / 2];
+  if (times.size() % 2 == 0)
+    median = (times[times.size() / 2 - 1] + median) / 2;
+  // nearest-rank percentile
+  double p95 = times[std::max<size_t>(1, std::ceil(0.95 * times.size())) - 1];
+
+  bool verified = sameResult(result, loadSnapshot<double>(
+                                         referencePath(opt, e.kind)));
+
+  std::ostringstream os;
+  os.precision(9);
+  os << "{\"file\": " << jsonString(in.path) << ", \"nodes\": " << in.nodes
+     << ", \"nnz\": " << a.nnz() << ", \"engine\": " << jsonString(e.name)
+     << ", \"kind\": \"" << kindName(e.kind) << "\", \"threads\": "
+     << pool.size() << ", \"warmup\": " << opt.warmup
+     << ", \"reps\": " << opt.reps << ", \"median_s\": " << median
+     << ", \"p95_s\": " << p95 << ", \"min_s\": " << times.front()
+     << ", \"gflops\": " << flops(e.kind, a) / median / 1e9
+     << ", \"peak_rss_bytes\": " << rss
+     << ", \"result_nnz\": " << result.nnz()
+     << ", \"verified\": " << (verified ? "true" : "false") << "}";
+  return os.str();
+}
+
+// Runs f in a child process and returns what it wrote, or "" if it failed.
+std::string inChild(const std::function<std::string()> &f) {
+  int fd[2];
+  if (pipe(fd) != 0)
+    return "";
+  std::cout.flush();
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fd[0]);
+    int rc = 0;
+    std::string out;
+    try {
+      out = f();
+    } catch (const std::exception &e) {
+      std::cerr << "    " << e.what() << std::endl;
+      rc = 1;
+    }
+    size_t done = 0;
+    while (done < out.size()) {
+      ssize_t w = write(fd[1], out.data() + done, out.size() - done);
+      if (w <= 0)
+        break;
+      done += w;
+    }
+    close(fd[1]);
+    _exit(rc);
+  }
+  close(fd[1]);
+  std::string out;
+  char buf[4096];
+  ssize_t r;
+  while ((r = read(fd[0], buf, sizeof(buf))) > 0)
+    out.append(buf, r);
+  close(fd[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  bool ok = pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  return ok ? out : "";
+}
+
+void usage(const char *name) {
+  std::cerr << "Usage: " << name
+            << " [--warmup N] [--reps N] [--max-nodes N] [--json file]"
+               " [files...]"
+            << std::endl;
+  std::cerr << "Without files, runs over files/test*.txt." << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--warmup" && hasValue)
+      opt.warmup = std::strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--reps" && hasValue)
+      opt.reps = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+    else if (arg == "--max-nodes" && hasValue)
+      opt.maxNodes = std::strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--json" && hasValue)
+      opt.json = argv[++i];
+    else if (arg.compare(0, 2, "--") == 0) {
+      usage(argv[0]);
+      return 1;
+    } else
+      opt.files.push_back(arg);
+  }
+  if (opt.files.empty()) {
+    glob_t g;
+    if (glob("files/test*.txt", 0, nullptr, &g) == 0) {
+      for (size_t i = 0; i < g.gl_pathc; i++)
+        opt.files.push_back(g.gl_pathv[i]);
+      globfree(&g);
+    }
+  }
+
+  std::vector<Input> inputs;
+  for (const std::string &f : opt.files) {
+    Input in;
+    if (probe(f, in))
+      inputs.push_back(in);
+    else
+      std::cerr << "skipping " << f << ": not a dataset" << std::endl;
+  }
+  std::sort(inputs.begin(), inputs.end(),
+            [](const Input &x, const Input &y) { return x.nodes < y.nodes; });
+
+  std::vector<std::string> records;
+  std::vector<Engine> all = engines();
+  for (const Input &in : inputs) {
+    std::vector<const Engine *> todo;
+    for (const Engine &e : all) {
+      if (applies(e, in, opt))
+        todo.push_back(&e);
+    }
+    if (todo.empty())
+      continue;
+
+    std::cerr << in.path << " (" << in.nodes << " nodes)" << std::endl;
+    std::string refs = inChild([&] {
+      writeReferences(in, opt);
+      return std::string("ok");
+    });
+    if (refs != "ok") {
+      std::cerr << "    reference failed, skipping" << std::endl;
+      continue;
+    }
+
+    for (const Engine *e : todo) {
+      std::string rec = inChild([&] { return runEngine(in, *e, opt); });
+      if (rec.empty()) {
+        std::cerr << "    " << e->name << ": failed" << std::endl;
+        continue;
+      }
+      std::cerr << "    " << rec << std::endl;
+      records.push_back(rec);
+    }
+    for (Kind k : {Closure, MinPlusProduct, Product})
+      std::remove(referencePath(opt, k).c_str());
+  }
+
+  std::ostringstream json;
+  json << "[\n";
+  for (size_t i = 0; i < records.size(); i++)
+    json << "  " << records[i] << (i + 1 < records.size() ? ",\n" : "\n");
+  json << "]\n";
+  if (opt.json.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream out(opt.json);
+    out << json.str();
+    if (!out) {
+      std::cerr << "cannot write " << opt.json << std::endl;
+      return 2;
+    }
+  }
+  return 0;
+}
@@ -1,15 +1,19 @@
 #include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
-#include <set>
-#include <sstream>
-#include <tuple>
 
+#include "lib/CompactCSR.hpp"
+#include "lib/DimacsLoader.hpp"
+#include "lib/DistanceView.hpp"
+#include "lib/MatrixSnapshot.hpp"
+#include "lib/MatrixWriter.hpp"
+#include "lib/OutOfCore.hpp"
+#include "lib/ResourceUsage.hpp"
 #include "lib/SparseMatrix.hpp"
 
-template <typename T> using Arc = std::tuple<size_t, size_t, T>;
-
 inline bool FileExists(const std::string &name) {
   std::ifstream f(name.c_str());
   return f.good();
@@ -17,79 +21,415 @@ inline bool FileExists(const std::string &name) {
 
 inline void CreateFile(const std::string &name) { std::ofstream outfile(name); }
 
-int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    std::cout << "Usage: " << argv[0] << " dataset" << std::endl;
-    return 1;
-  }
+static double Seconds(std::chrono::high_resolution_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::duration<double>>(
+             std::chrono::high_resolution_clock::now() - start)
+      .count();
+}
 
-  if (!FileExists(argv[1])) {
-    std::cout << "File " << argv[1] << " does not exists." << std::endl;
-    return 2;
+static void Usage(const char *name) {
+  std::cout << "Usage: " << name
+            << " [-o result] [--weights double|float|int32|uint16] [--packed]"
+            << std::endl
+            << "       dataset [auto|squaring|dijkstra|seminaive|outofcore "
+               "[budget-MB]|query [sources]|paths|within radius|"
+               "nearest k]"
+            << std::endl;
+  std::cout << "       " << name << " --convert dataset snapshot" << std::endl;
+  std::cout << "Results ending in .snap are written as binary snapshots "
+               "(.rows for outofcore),"
+            << std::endl;
+  std::cout << "anything else as DIMACS arcs." << std::endl;
+  std::cout << "auto picks squaring or dijkstra from a sampled cost model."
+            << std::endl;
+  std::cout << "outofcore spills row blocks to disk; budget-MB (default "
+               "256) bounds the engine's"
+            << std::endl;
+  std::cout << "own memory (operand, scratch, result blocks), not the "
+               "process RSS."
+            << std::endl;
+  std::cout << "query computes only the rows of evenly spaced sources "
+               "(default 100)."
+            << std::endl;
+  std::cout << "paths also records the predecessor of every entry and "
+               "prints a sample route."
+            << std::endl;
+  std::cout << "within and nearest keep only the pairs up to radius apart, "
+               "or the k nearest"
+            << std::endl;
+  std::cout << "targets of every source." << std::endl;
+  std::cout << "--weights and --packed give the engines other than auto, "
+               "squaring and query"
+            << std::endl;
+  std::cout << "a compact operand: narrower weights, 32-bit or varint-coded "
+               "columns."
+            << std::endl;
+}
+
+static bool EndsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void WriteResult(const CSRMatrix<double> &result,
+                        const std::string &path, thread_pool &pool) {
+  std::cout << "Writing result " << path << "... " << std::flush;
+  auto start = std::chrono::high_resolution_clock::now();
+  size_t bytes = EndsWith(path, ".snap") ? writeBinary(result, path)
+                                         : writeDimacs(result, path, &pool);
+  double elapsed = Seconds(start);
+  std::cout << "Done, elapsed time: " << elapsed << " seconds ("
+            << bytes / 1e6 / elapsed << " MB/s)." << std::endl;
+}
+
+struct SemiNaiveEngine {
+  typedef CSRMatrix<double> result_type;
+  thread_pool *pool;
+
+  template <typename M> result_type operator()(const M &a) const {
+    return semiNaiveClosure<MinPlus<double>>(a, pool);
   }
+};
 
-  std::ifstream dataset_file(argv[1]);
-  std::string line;
+struct DijkstraEngine {
+  typedef CSRMatrix<double> result_type;
+  thread_pool *pool;
 
-  int num_nodes = 0;
-  int num_arcs = 0;
-  std::set<Arc<double>> data;
+  template <typename M> result_type operator()(const M &a) const {
+    return dijkstraClosure<MinPlus<double>>(a, pool);
+  }
+};
 
-  while (std::getline(dataset_file, line)) {
-    std::stringstream stream(line);
+struct PathEngine {
+  typedef PathClosure<double> result_type;
+  thread_pool *pool;
 
-    char info;
-    stream >> info;
+  template <typename M> result_type operator()(const M &a) const {
+    return pathClosure<MinPlus<double>>(a, pool);
+  }
+};
 
-    if (info == 'p') {
-      std::string temp;
-      stream >> temp;
-      if (temp == "sp") {
-        stream >> num_nodes >> num_arcs;
-      }
-    } else if (info == 'a') {
-      size_t i, j;
-      double value;
-      stream >> i >> j >> value;
-      data.emplace(i - 1, j - 1, value);
-    }
+struct BoundedEngine {
+  typedef CSRMatrix<double> result_type;
+  SearchBounds<double> bounds;
+  thread_pool *pool;
+
+  template <typename M> result_type operator()(const M &a) const {
+    return boundedClosure<MinPlus<double>>(a, bounds, pool);
   }
+};
 
-  dataset_file.close();
-  num_arcs = data.size();
+struct OutOfCoreEngine {
+  typedef OutOfCoreStats result_type;
+  std::string spill;
+  size_t budget;
+  thread_pool *pool;
 
-  std::cout << "DATASET INFORMATION" << std::endl;
-  std::cout << "    Number of nodes: " << num_nodes << std::endl;
-  std::cout << "    Number of arcs: " << num_arcs << std::endl;
+  template <typename M> result_type operator()(const M &a) const {
+    return outOfCoreClosure<MinPlus<double>>(a, spill, budget, pool);
+  }
+};
 
-  std::cout << std::endl;
-  std::cout << std::fixed;
+template <typename W, typename Engine>
+static typename Engine::result_type
+RunCompact(CSRMatrix<double> &mat, bool packed, const Engine &run) {
+  std::cout << "Compacting operand... " << std::flush;
+  auto start = std::chrono::high_resolution_clock::now();
+  size_t before = mat.bytes();
+  if (packed) {
+    PackedCSR<W> a = PackedCSR<W>::fromCSR(mat);
+    mat = CSRMatrix<double>();
+    std::cout << "Done, elapsed time: " << Seconds(start) << " seconds, "
+              << before / 1e6 << " MB -> " << a.bytes() / 1e6 << " MB."
+              << std::endl;
+    return run(a);
+  }
+  CompactCSR<W> a = CompactCSR<W>::fromCSR(mat);
+  mat = CSRMatrix<double>();
+  std::cout << "Done, elapsed time: " << Seconds(start) << " seconds, "
+            << before / 1e6 << " MB -> " << a.bytes() / 1e6 << " MB."
+            << std::endl;
+  return run(a);
+}
 
-  std::cout << "Done." << std::endl;
+// Runs the engine on mat as loaded, or on a compact copy that replaces it.
+template <typename Engine>
+static typename Engine::result_type RunOn(CSRMatrix<double> &mat,
+                                          const std::string &weights,
+                                          bool packed, const Engine &run) {
+  if (weights == "float")
+    return RunCompact<float>(mat, packed, run);
+  if (weights == "int32")
+    return RunCompact<int32_t>(mat, packed, run);
+  if (weights == "uint16")
+    return RunCompact<uint16_t>(mat, packed, run);
+  if (packed)
+    return RunCompact<double>(mat, packed, run);
+  return run(mat);
+}
+
+// Loads a DIMACS text file, or maps a binary snapshot written by --convert.
+static CSRMatrix<double> LoadMatrix(const std::string &path,
+                                    thread_pool &pool) {
   std::cout << "Loading Matrix... " << std::flush;
   auto start = std::chrono::high_resolution_clock::now();
 
-  SparseMatrix<double> mat(num_nodes, num_nodes);
-  for (auto &arc : data) {
-    mat.set(std::get<2>(arc), std::get<0>(arc), std::get<1>(arc));
+  if (isSnapshot(path)) {
+    CSRMatrix<double> mat = loadSnapshot<double>(path);
+    std::cout << "Done, elapsed time: " << Seconds(start) << " seconds."
+              << std::endl;
+    std::cout << std::endl;
+    std::cout << "DATASET INFORMATION (snapshot)" << std::endl;
+    std::cout << "    Number of nodes: " << mat.getNumRows() << std::endl;
+    std::cout << "    Number of arcs: " << mat.nnz() << std::endl;
+    std::cout << std::endl;
+    return mat;
   }
 
-  auto end = std::chrono::high_resolution_clock::now();
-  auto elapsed =
-      std::chrono::duration_cast<std::chrono::duration<double>>(end - start);
-  std::cout << "Done, elapsed time: " << elapsed.count() << " seconds."
+  DimacsStats stats;
+  CSRMatrix<double> mat = loadDimacsCSR<double>(path, pool, &stats);
+  std::cout << "Done, elapsed time: " << stats.totalSeconds << " seconds."
             << std::endl;
 
-  std::cout << "Init mult..." << std::endl;
-  start = std::chrono::high_resolution_clock::now();
-  SparseMatrix<double> result = mat.diamondConcurrent();
-  // SparseMatrix<double> result2 = mat.diamond();
-  // SparseMatrix<double> result3 = mat * mat;
-  end = std::chrono::high_resolution_clock::now();
-  elapsed =
-      std::chrono::duration_cast<std::chrono::duration<double>>(end - start);
-  std::cout << "Done, elapsed time: " << elapsed.count() << " seconds."
-            << std::endl;
+  std::cout << std::endl;
+  std::cout << "DATASET INFORMATION" << std::endl;
+  std::cout << "    Number of nodes: " << stats.nodes << std::endl;
+  std::cout << "    Number of arcs: " << stats.arcs << std::endl;
+  if (stats.duplicates)
+    std::cout << "    Duplicate arcs: " << stats.duplicates << std::endl;
+  if (stats.skipped)
+    std::cout << "    Out of range arcs skipped: " << stats.skipped
+              << std::endl;
+  std::cout << "    Parsed " << stats.bytes / 1e6 << " MB in "
+            << stats.parseSeconds << " seconds (" << stats.parseMBps()
+            << " MB/s)" << std::endl;
+  std::cout << std::endl;
+  return mat;
+}
+
+int main(int argc, char *argv[]) {
+  std::cout << std::fixed;
+  std::string output;
+  std::string weights = "double";
+  bool packed = false;
+  while (argc > 1 && argv[1][0] == '-' &&
+         std::string(argv[1]) != "--convert") {
+    std::string opt = argv[1];
+    if (opt == "--packed") {
+      packed = true;
+      argv[1] = argv[0];
+      argv++;
+      argc--;
+    } else if (argc > 2 &&
+               (opt == "-o" || opt == "--output" || opt == "--weights")) {
+      (opt == "--weights" ? weights : output) = argv[2];
+      argv[2] = argv[0];
+      argv += 2;
+      argc -= 2;
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+  if (weights != "double" && weights != "float" && weights != "int32" &&
+      weights != "uint16") {
+    std::cout << "Unknown weight type " << weights << "." << std::endl;
+    return 1;
+  }
+  bool compact = packed || weights != "double";
+  bool convert = argc > 1 && std::string(argv[1]) == "--convert";
+  if (convert ? (argc != 4 || !output.empty() || compact)
+              : (argc < 2 || argc > 4)) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  std::string input = convert ? argv[2] : argv[1];
+  std::string engine = !convert && argc >= 3 ? argv[2] : "auto";
+  if (engine != "auto" && engine != "squaring" && engine != "dijkstra" &&
+      engine != "seminaive" && engine != "outofcore" && engine != "query" &&
+      engine != "paths" && engine != "within" && engine != "nearest") {
+    std::cout << "Unknown engine " << engine << "." << std::endl;
+    return 1;
+  }
+  bool bounded = engine == "within" || engine == "nearest";
+  if (argc == 4 ? engine != "outofcore" && engine != "query" && !bounded
+                : bounded) {
+    Usage(argv[0]);
+    return 1;
+  }
+  if (compact &&
+      (engine == "squaring" || engine == "auto" || engine == "query")) {
+    std::cout << "Squaring rewrites its operand every round; --weights and "
+                 "--packed do not apply to auto, squaring and query."
+              << std::endl;
+    return 1;
+  }
+  if (engine == "outofcore" && EndsWith(output, ".snap")) {
+    std::cout << "The outofcore engine writes .rows files, not snapshots."
+              << std::endl;
+    return 1;
+  }
+  if (engine == "query" && !output.empty()) {
+    std::cout << "query prints timings only; it writes no result."
+              << std::endl;
+    return 1;
+  }
+  size_t budgetMB = argc == 4 ? std::strtoul(argv[3], nullptr, 10) : 256;
+  size_t sources = argc == 4 ? std::strtoul(argv[3], nullptr, 10) : 100;
+  SearchBounds<double> bounds =
+      engine == "within"
+          ? SearchBounds<double>::within(std::strtod(argv[3], nullptr))
+          : SearchBounds<double>::nearest(
+                engine == "nearest" ? std::strtoul(argv[3], nullptr, 10) : 0);
+
+  if (!FileExists(input)) {
+    std::cout << "File " << input << " does not exists." << std::endl;
+    return 2;
+  }
+
+  thread_pool pool;
+
+  try {
+    CSRMatrix<double> mat = LoadMatrix(input, pool);
+
+    if (convert) {
+      std::cout << "Writing snapshot " << argv[3] << "... " << std::flush;
+      auto start = std::chrono::high_resolution_clock::now();
+      saveSnapshot(mat, argv[3]);
+      std::cout << "Done, elapsed time: " << Seconds(start) << " seconds."
+                << std::endl;
+      return 0;
+    }
+
+    if (engine == "outofcore") {
+      // a .rows result is the spill file itself; otherwise spill next to
+      // the other temporaries and drop the file at exit
+      bool keep = EndsWith(output, ".rows");
+      std::string spill = keep ? output
+                               : std::string(P_tmpdir) + "/dataset-" +
+                                     std::to_string(getpid()) + ".rows";
+      size_t before = currentRSSBytes();
+      std::cout << "Init out-of-core closure, engine budget " << budgetMB
+                << " MB (not an RSS bound)..." << std::endl;
+      OutOfCoreEngine run = {spill, budgetMB << 20, &pool};
+      OutOfCoreStats st;
+      try {
+        st = RunOn(mat, weights, packed, run);
+      } catch (...) {
+        std::remove(spill.c_str());
+        throw;
+      }
+      std::cout << "Done, elapsed time: " << st.seconds << " seconds."
+                << std::endl;
+      std::cout << "    Result entries: " << st.nnz << std::endl;
+      std::cout << "    Row blocks: " << st.blocks << ", "
+                << st.bytesWritten / 1e6 << " MB spilled" << std::endl;
+      std::cout << "    Fixed engine memory: " << st.fixedBytes / 1e6
+                << " MB, largest result block: " << st.peakBlockBytes / 1e6
+                << " MB of " << st.blockBudget / 1e6 << " MB" << std::endl;
+      // allocator overhead, thread stacks and the loaded input are outside
+      // the engine budget
+      std::cout << "    RSS before: " << before / 1e6
+                << " MB, peak RSS: " << peakRSSBytes() / 1e6
+                << " MB (budget covers engine memory only)" << std::endl;
+
+      if (!output.empty() && !keep) {
+        std::cout << "Writing result " << output << "... " << std::flush;
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t bytes;
+        try {
+          // streamed one row block at a time, so it stays out of core
+          RowBlockReader<double> reader(spill);
+          bytes = writeDimacs(reader, output, &pool);
+        } catch (...) {
+          std::remove(spill.c_str());
+          throw;
+        }
+        double elapsed = Seconds(start);
+        std::cout << "Done, elapsed time: " << elapsed << " seconds ("
+                  << bytes / 1e6 / elapsed << " MB/s)." << std::endl;
+      }
+      if (!keep)
+        std::remove(spill.c_str());
+      return 0;
+    }
+
+    if (engine == "query") {
+      size_t n = mat.getNumRows();
+      std::vector<size_t> wanted;
+      for (size_t k = 0; k < sources && k < n; k++)
+        wanted.push_back(k * n / std::min(sources, n));
+      std::cout << "Init distance rows for " << wanted.size()
+                << " sources..." << std::endl;
+      auto start = std::chrono::high_resolution_clock::now();
+      DistanceView<MinPlus<double>> view(std::move(mat));
+      size_t entries = 0;
+      for (const auto &row : view.rows(wanted, &pool))
+        entries += row->nnz();
+      std::cout << "Done, elapsed time: " << Seconds(start) << " seconds."
+                << std::endl;
+      std::cout << "    Row entries: " << entries << std::endl;
+      std::cout << "    Cached: " << view.cacheStats().rows << " rows, "
+                << view.cacheStats().bytes / 1e6 << " MB" << std::endl;
+      std::cout << "    Peak RSS: " << peakRSSBytes() / 1e6 << " MB"
+                << std::endl;
+      return 0;
+    }
+
+    std::cout << "Init mult..." << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    // the engines only read mat, so a mapped snapshot is used in place
+    CSRMatrix<double> result;
+    if (engine == "seminaive") {
+      SemiNaiveEngine run = {&pool};
+      result = RunOn(mat, weights, packed, run);
+    } else if (engine == "dijkstra") {
+      DijkstraEngine run = {&pool};
+      result = RunOn(mat, weights, packed, run);
+    } else if (bounded) {
+      BoundedEngine run = {bounds, &pool};
+      result = RunOn(mat, weights, packed, run);
+    } else if (engine == "paths") {
+      PathEngine run = {&pool};
+      PathClosure<double> paths = RunOn(mat, weights, packed, run);
+      std::cout << "    Predecessors: " << paths.pred.size() * 4 / 1e6 << " MB"
+                << std::endl;
+      // the route from vertex 1 to the farthest vertex it reaches
+      const CSRMatrix<double> &d = paths.dist;
+      if (d.getNumRows() && d.rowSize(0)) {
+        size_t far = d.rowBegin(0);
+        for (size_t p = d.rowBegin(0); p < d.rowEnd(0); p++)
+          far = d.value(p) > d.value(far) ? p : far;
+        std::vector<size_t> route = paths.path(0, d.col(far));
+        std::cout << "    Route 1 -> " << d.col(far) + 1 << ": "
+                  << route.size() - 1 << " arcs, length " << d.value(far)
+                  << std::endl;
+      }
+      result = std::move(paths.dist);
+    } else if (engine == "auto") {
+      ClosurePlan plan;
+      result = autoClosure<MinPlus<double>>(mat, &pool, 0.1, &plan);
+      std::cout << "    Engine: " << closureEngineName(plan.engine)
+                << " (sampled reach " << plan.reach << ", degree "
+                << plan.degree << "; model " << plan.squaringSeconds
+                << " s squaring, " << plan.dijkstraSeconds
+                << " s dijkstra)" << std::endl;
+    } else {
+      result = squaringClosure<MinPlus<double>>(mat, &pool);
+    }
+    std::cout << "Done, elapsed time: " << Seconds(start) << " seconds."
+              << std::endl;
+    std::cout << "    Result entries: " << result.nnz() << std::endl;
+    std::cout << "    Peak RSS: " << peakRSSBytes() / 1e6 << " MB"
+              << std::endl;
+
+    if (!output.empty())
+      WriteResult(result, output, pool);
+  } catch (const std::exception &e) {
+    std::cout << std::endl << e.what() << std::endl;
+    return 3;
+  }
 
   return 0;
 }
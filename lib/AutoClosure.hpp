@@ -0,0 +1,109 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "Closure.hpp"
+#include "Dijkstra.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Engine selection for the closure. A handful of searches from evenly
+// spaced sources measure the mean closure row size r and the mean degree d
+// of the vertices they reach, and a cost model compares
+//
+//   per-source Dijkstra  n * (r * d + r * log2(r) * log2(d + 2)) steps
+//   squaring             about 2.5 * n * r^2 partial products over all
+//                        rounds, or n^3 dense updates once r passes the
+//                        dense threshold and Floyd-Warshall takes over
+//
+// The per-step costs below were measured on the bundled datasets; only
+// their ratios matter. Dijkstra is only chosen when label setting applies
+// to the weights (see Dijkstra.hpp).
+
+enum class ClosureEngine { Squaring, Dijkstra };
+
+inline const char *closureEngineName(ClosureEngine e) {
+  return e == ClosureEngine::Dijkstra ? "dijkstra" : "squaring";
+}
+
+struct ClosurePlan {
+  ClosureEngine engine;
+  double reach;  // sampled mean closure row size
+  double degree; // mean out-degree of the reached vertices
+  double squaringSeconds;
+  double dijkstraSeconds;
+
+  ClosurePlan()
+      : engine(ClosureEngine::Squaring), reach(0), degree(0),
+        squaringSeconds(0), dijkstraSeconds(0) {}
+};
+
+namespace closureplan {
+
+const double productSeconds = 3e-9; // one partial product, both phases
+const double denseSeconds = 2e-10;  // one Floyd-Warshall update
+const double searchSeconds = 8e-9;  // one edge scan or heap step
+const size_t samples = 32;
+const size_t minSamples = 4;
+
+} // namespace closureplan
+
+template <typename S, typename T>
+ClosurePlan planClosure(const CSRMatrix<T> &a, double denseThreshold = 0.1) {
+  assert(a.getNumRows() == a.getNumCols());
+  ClosurePlan plan;
+  size_t n = a.getNumRows();
+  if (n == 0)
+    return plan;
+
+  // The reached set does not depend on the weights, so the samples are
+  // valid even when label setting is not. Sources step by the golden
+  // ratio, so any prefix of them is spread over all rows, and sampling
+  // stops early once it has scanned a few times the operand, so dense
+  // inputs stay cheap.
+  DijkstraScratch<T> s;
+  s.resize(n);
+  size_t k = std::min(closureplan::samples, n);
+  double budget = 2.0 * (a.nnz() + n);
+  double reached = 0, scanned = 0;
+  size_t taken = 0;
+  while (taken < k && (taken < closureplan::minSamples || scanned < budget)) {
+    size_t source = size_t(std::fmod(taken * 0.6180339887, 1.0) * n);
+    dijkstraRow<S>(a, std::min(source, n - 1), s);
+    reached += s.order.size();
+    for (size_t v : s.order)
+      scanned += a.rowSize(v);
+    s.dist.flush([](size_t, const T &) {});
+    taken++;
+  }
+
+  double r = reached / taken;
+  double d = reached ? scanned / reached : 0;
+  double nn = double(n);
+  plan.reach = r;
+  plan.degree = d;
+  plan.dijkstraSeconds = closureplan::searchSeconds * nn *
+                         (r * d + r * std::log2(r + 1) * std::log2(d + 2));
+  plan.squaringSeconds =
+      r > denseThreshold * nn
+          ? closureplan::denseSeconds * nn * nn * nn
+          : closureplan::productSeconds * 2.5 * nn * r * r;
+  if (plan.dijkstraSeconds < plan.squaringSeconds && labelSettingApplies<S>(a))
+    plan.engine = ClosureEngine::Dijkstra;
+  return plan;
+}
+
+// Same result as squaringClosure<S>(), on the engine planClosure expects
+// to be cheaper; the plan is returned through plan when given.
+template <typename S, typename T>
+CSRMatrix<T> autoClosure(const CSRMatrix<T> &a, thread_pool *pool = nullptr,
+                         double denseThreshold = 0.1,
+                         ClosurePlan *plan = nullptr) {
+  MATRICES_PHASE("closure.auto");
+  ClosurePlan p = planClosure<S>(a, denseThreshold);
+  if (plan)
+    *plan = p;
+  if (p.engine == ClosureEngine::Dijkstra)
+    return dijkstraClosure<S>(a, pool);
+  return squaringClosure<S>(a, pool, denseThreshold);
+}
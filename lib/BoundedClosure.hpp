@@ -0,0 +1,69 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "Dijkstra.hpp"
+#include "Instrument.hpp"
+#include "SpGEMM.hpp"
+#include "ThreadPool.hpp"
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+// Closure restricted to what a query asks for, instead of every reachable
+// pair: the min-plus closure of a connected graph is dense, while most
+// consumers want only
+//
+//   within(r)   the pairs at distance r or less (under S's order)
+//   nearest(k)  the k best targets of every source
+//
+// Each row is a Dijkstra search that never keeps a label beyond the
+// radius and stops after settling k vertices, so both the result and the
+// work scale with the rows asked for: about n * k * d heap steps for
+// nearest(k) at average degree d, independent of how much of the graph
+// each source reaches. The kept entries equal the corresponding entries
+// of squaringClosure<S>(). Among targets tied at the k-th best value,
+// nearest(k) keeps an arbitrary subset. (i, i) counts as a target only
+// through a cycle, as in the full closure.
+//
+// Pruning a label is only sound when extending a path never makes it
+// better, so label setting must apply (see Dijkstra.hpp); boundedClosure
+// throws std::domain_error otherwise.
+
+template <typename S, typename M>
+CSRMatrix<typename S::value_type>
+boundedClosure(const M &a, const SearchBounds<typename S::value_type> &bounds,
+               thread_pool *pool = nullptr) {
+  typedef typename S::value_type T;
+  static_assert(S::idempotent, "label setting needs an idempotent S");
+  assert(a.getNumRows() == a.getNumCols());
+  if (!labelSettingApplies<S>(a))
+    throw std::domain_error("boundedClosure: a weight would improve the "
+                            "paths it extends (negative min-plus weight?)");
+  MATRICES_PHASE("closure.bounded");
+  size_t n = a.getNumRows();
+
+  std::vector<std::vector<size_t>> rowCols(n);
+  std::vector<std::vector<T>> rowVals(n);
+  std::vector<DijkstraScratch<T>> scratch(workerSlots(pool));
+
+  forEachRange(pool, n, [&](size_t begin, size_t end) {
+    DijkstraScratch<T> &s = scratch[workerSlot(pool)];
+    s.resize(n);
+    for (size_t i = begin; i < end; i++) {
+      dijkstraRow<S>(a, i, s, IgnoreImprovements(), bounds);
+      auto &c = rowCols[i];
+      auto &v = rowVals[i];
+      c.reserve(s.order.size());
+      v.reserve(s.order.size());
+      // labels left unsettled when the search stopped are dropped
+      s.dist.flush([&](size_t col, const T &value) {
+        if (s.settled[col] && value != T(0)) {
+          c.push_back(col);
+          v.push_back(value);
+        }
+      });
+    }
+  });
+
+  return concatRows(n, rowCols, rowVals, pool);
+}
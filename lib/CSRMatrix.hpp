@@ -0,0 +1,228 @@
+#pragma once
+
+#include "Instrument.hpp"
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Owned CSR arrays detached from a matrix, for reuse as the output of a
+// later kernel; their contents are meaningless, only the capacity counts.
+template <typename T> struct CSRBuffers {
+  std::vector<size_t> ptr;
+  std::vector<size_t> idx;
+  std::vector<T> val;
+};
+
+// Immutable compressed sparse row storage. Row r owns the half-open range
+// [rowPtr[r], rowPtr[r + 1]) of colIdx/values, with columns sorted ascending
+// and no explicit zeros, the same invariants as the map-based SparseMatrix.
+//
+// The arrays are usually owned, but a matrix can also borrow them from
+// storage kept alive by a shared owner, e.g. a memory-mapped snapshot (see
+// MatrixSnapshot.hpp); kernels read both kinds through the same pointers.
+template <typename T> class CSRMatrix {
+private:
+  size_t rows;
+  size_t cols;
+  std::vector<size_t> rowPtr;
+  std::vector<size_t> colIdx;
+  std::vector<T> values;
+
+  // keeps borrowed arrays alive; null when the vectors above own the data
+  std::shared_ptr<const void> backing;
+  const size_t *ptrData;
+  const size_t *idxData;
+  const T *valData;
+
+  void bind() {
+    if (!backing) {
+      ptrData = rowPtr.data();
+      idxData = colIdx.data();
+      valData = values.data();
+    }
+  }
+
+public:
+  typedef T value_type;
+
+  CSRMatrix() : rows(0), cols(0), rowPtr(1, 0) { bind(); }
+  CSRMatrix(size_t r, size_t c) : rows(r), cols(c), rowPtr(r + 1, 0) {
+    bind();
+  }
+  CSRMatrix(size_t r, size_t c, std::vector<size_t> ptr,
+            std::vector<size_t> idx, std::vector<T> val)
+      : rows(r), cols(c), rowPtr(std::move(ptr)), colIdx(std::move(idx)),
+        values(std::move(val)) {
+    assert(rowPtr.size() == rows + 1);
+    assert(colIdx.size() == rowPtr[rows] && values.size() == rowPtr[rows]);
+    bind();
+  }
+
+  // Read-only view of arrays owned by someone else; owner must keep them
+  // valid for as long as any copy of this matrix exists.
+  CSRMatrix(size_t r, size_t c, const size_t *ptr, const size_t *idx,
+            const T *val, std::shared_ptr<const void> owner)
+      : rows(r), cols(c), backing(std::move(owner)), ptrData(ptr),
+        idxData(idx), valData(val) {
+    assert(backing && ptrData);
+  }
+
+  CSRMatrix(const CSRMatrix<T> &other)
+      : rows(other.rows), cols(other.cols), rowPtr(other.rowPtr),
+        colIdx(other.colIdx), values(other.values), backing(other.backing),
+        ptrData(other.ptrData), idxData(other.idxData),
+        valData(other.valData) {
+    bind();
+  }
+
+  CSRMatrix(CSRMatrix<T> &&other)
+      : rows(other.rows), cols(other.cols), rowPtr(std::move(other.rowPtr)),
+        colIdx(std::move(other.colIdx)), values(std::move(other.values)),
+        backing(std::move(other.backing)), ptrData(other.ptrData),
+        idxData(other.idxData), valData(other.valData) {
+    bind();
+  }
+
+  CSRMatrix<T> &operator=(CSRMatrix<T> other) {
+    rows = other.rows;
+    cols = other.cols;
+    rowPtr.swap(other.rowPtr);
+    colIdx.swap(other.colIdx);
+    values.swap(other.values);
+    backing.swap(other.backing);
+    ptrData = other.ptrData;
+    idxData = other.idxData;
+    valData = other.valData;
+    bind();
+    return *this;
+  }
+
+  // Gives up the owned arrays for reuse and leaves an empty 0 x 0 matrix.
+  // A borrowed matrix has nothing to give, so its buffers come back empty.
+  CSRBuffers<T> release() {
+    CSRBuffers<T> buf;
+    buf.ptr.swap(rowPtr);
+    buf.idx.swap(colIdx);
+    buf.val.swap(values);
+    *this = CSRMatrix<T>();
+    return buf;
+  }
+
+  // conversion from the map-based row form
+  static CSRMatrix<T> fromRows(size_t c,
+                               const std::vector<std::map<size_t, T>> &rowMaps) {
+    MATRICES_PHASE("csr.fromRows");
+    size_t r = rowMaps.size();
+    std::vector<size_t> ptr(r + 1, 0);
+    for (size_t i = 0; i < r; i++)
+      ptr[i + 1] = ptr[i] + rowMaps[i].size();
+
+    std::vector<size_t> idx(ptr[r]);
+    std::vector<T> val(ptr[r]);
+    for (size_t i = 0; i < r; i++) {
+      size_t p = ptr[i];
+      for (const auto &it : rowMaps[i]) {
+        idx[p] = it.first;
+        val[p] = it.second;
+        p++;
+      }
+    }
+    return CSRMatrix<T>(r, c, std::move(ptr), std::move(idx), std::move(val));
+  }
+
+  // conversion back to the map-based row form
+  std::vector<std::map<size_t, T>> toRows() const {
+    MATRICES_PHASE("csr.toRows");
+    std::vector<std::map<size_t, T>> rowMaps(rows);
+    for (size_t i = 0; i < rows; i++) {
+      auto &r = rowMaps[i];
+      // columns are sorted, so every insert lands at the end
+      for (size_t p = ptrData[i]; p < ptrData[i + 1]; p++)
+        r.emplace_hint(r.end(), idxData[p], valData[p]);
+    }
+    return rowMaps;
+  }
+
+  // getters
+  size_t getNumRows() const { return rows; }
+  size_t getNumCols() const { return cols; }
+  size_t nnz() const { return ptrData[rows]; }
+  bool isBorrowed() const { return backing != nullptr; }
+
+  size_t rowBegin(size_t r) const { return ptrData[r]; }
+  size_t rowEnd(size_t r) const { return ptrData[r + 1]; }
+  size_t rowSize(size_t r) const { return ptrData[r + 1] - ptrData[r]; }
+
+  size_t col(size_t p) const { return idxData[p]; }
+  const T &value(size_t p) const { return valData[p]; }
+
+  // f(col, value) for each entry of row r in column order, the visitor
+  // shared with the compact forms (see CompactCSR.hpp)
+  template <typename F> void forEachInRow(size_t r, F f) const {
+    for (size_t p = ptrData[r]; p < ptrData[r + 1]; p++)
+      f(idxData[p], valData[p]);
+  }
+
+  size_t bytes() const {
+    return (rows + 1) * sizeof(size_t) + nnz() * (sizeof(size_t) + sizeof(T));
+  }
+
+  // raw arrays: rows + 1 offsets, nnz column indices, nnz values
+  const size_t *getRowPtr() const { return ptrData; }
+  const size_t *getColIdx() const { return idxData; }
+  const T *getValues() const { return valData; }
+
+  T get(size_t i, size_t j) const {
+    const size_t *first = idxData + ptrData[i];
+    const size_t *last = idxData + ptrData[i + 1];
+    const size_t *it = std::lower_bound(first, last, j);
+    if (it != last && *it == j)
+      return valData[it - idxData];
+    return T(0);
+  }
+};
+
+// Appends rows in order; used by kernels that emit each output row once.
+template <typename T> class CSRBuilder {
+private:
+  size_t rows;
+  size_t cols;
+  std::vector<size_t> rowPtr;
+  std::vector<size_t> colIdx;
+  std::vector<T> values;
+
+public:
+  CSRBuilder(size_t r, size_t c, size_t nnzHint = 0) : rows(r), cols(c) {
+    rowPtr.reserve(r + 1);
+    rowPtr.push_back(0);
+    colIdx.reserve(nnzHint);
+    values.reserve(nnzHint);
+  }
+
+  size_t currentRow() const { return rowPtr.size() - 1; }
+
+  // columns inside a row must be pushed in ascending order
+  void push(size_t c, const T &v) {
+    assert(currentRow() < rows && c < cols);
+    assert(rowPtr.back() == colIdx.size() || colIdx.back() < c);
+    if (v != T(0)) {
+      colIdx.push_back(c);
+      values.push_back(v);
+    }
+  }
+
+  void finishRow() {
+    assert(currentRow() < rows);
+    rowPtr.push_back(colIdx.size());
+  }
+
+  CSRMatrix<T> build() {
+    while (currentRow() < rows)
+      finishRow();
+    return CSRMatrix<T>(rows, cols, std::move(rowPtr), std::move(colIdx),
+                        std::move(values));
+  }
+};
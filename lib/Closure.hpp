@@ -0,0 +1,82 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "DenseMatrix.hpp"
+#include "FloydWarshall.hpp"
+#include "Instrument.hpp"
+#include "Semiring.hpp"
+#include "SpGEMM.hpp"
+#include "ThreadPool.hpp"
+#include <cassert>
+#include <vector>
+
+// Closure engines on CSR operands. They only read their input, so it may
+// be a borrowed matrix such as a memory-mapped snapshot.
+
+// Same result as squaringClosure<S>(), always on the dense Floyd-Warshall
+// engine.
+template <typename S, typename T>
+CSRMatrix<T> denseClosure(const CSRMatrix<T> &x, thread_pool *pool = nullptr) {
+  assert(x.getNumRows() == x.getNumCols());
+  MATRICES_PHASE("closure.dense");
+  DenseMatrix<T> d = DenseMatrix<T>::template fromCSR<S>(x);
+  floydWarshall<S>(d, pool);
+  return d.template toCSR<S>();
+}
+
+// Transitive closure A (+) A^2 (+) A^3 ... for an idempotent S: entry
+// (i, j) of the min-plus closure is the shortest path from i to j with at
+// least one edge. Squares X <- X (+) X (x) X, so after t rounds X covers
+// all paths of up to 2^t edges, and stops early once a round changes no
+// entry, which on short-diameter graphs is far fewer than log2(rows).
+// Each round sizes X (+) X (x) X with the symbolic pass first; if it
+// would hold more than denseThreshold * rows^2 entries, the rest is handed
+// to the blocked Floyd-Warshall engine on a dense copy of X before the
+// product is ever materialised.
+//
+// The rounds ping-pong between two sets of arrays: the X of two rounds ago
+// is released and refilled as the next X, so once nnz levels off no round
+// allocates, and at most the current and the next X are alive. The first
+// round reads a directly instead of copying it.
+template <typename S, typename T>
+CSRMatrix<T> squaringClosure(const CSRMatrix<T> &a,
+                             thread_pool *pool = nullptr,
+                             double denseThreshold = 0.1) {
+  static_assert(S::idempotent, "closure needs an idempotent semiring");
+  assert(a.getNumRows() == a.getNumCols());
+  MATRICES_PHASE("closure.squaring");
+  size_t rows = a.getNumRows();
+  const CSRMatrix<T> *x = &a;
+  CSRMatrix<T> current;
+  CSRBuffers<T> spare;
+
+  // shortest walks (including cycles) have at most rows edges
+  for (size_t span = 1; span < rows; span *= 2) {
+    // an X already past the threshold skips the symbolic pass, which
+    // would cost as much as a dense round
+    if (x->nnz() > denseThreshold * rows * rows)
+      return denseClosure<S>(*x, pool);
+    size_t products = 0;
+    spgemmSymbolic(*x, *x, x, pool, spare.ptr, &products);
+    if (spare.ptr.back() > denseThreshold * rows * rows)
+      return denseClosure<S>(*x, pool);
+    bool changed = false;
+    MATRICES_COUNT("spgemm.products", products);
+    MATRICES_INSTRUMENTED(
+        instrument::RoundStats round = {x->nnz(), products, 0, 0};
+        auto start = instrument::Clock::now();)
+    CSRMatrix<T> next =
+        spgemmNumeric<S>(*x, *x, x, std::move(spare), pool, &changed);
+    spare = current.release();
+    current = std::move(next);
+    x = &current;
+    MATRICES_INSTRUMENTED(round.nnzOut = x->nnz();
+                          round.seconds = instrument::seconds(start);
+                          instrument::registry().round(round);)
+    if (!changed)
+      break;
+  }
+  if (x == &a)
+    return a;
+  return current;
+}
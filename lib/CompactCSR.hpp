@@ -0,0 +1,193 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Read-only compressed forms of a CSRMatrix, for operands that are read
+// over and over (the A of the semi-naive and out-of-core closures) on
+// graphs where memory or cache runs out before the CPU does:
+//
+//   CompactCSR<W, I>  column indices of type I (32 bits by default) and
+//                     weights of type W: 4 + sizeof(W) bytes per entry
+//                     instead of 16 for CSRMatrix<double>
+//   PackedCSR<W>      column gaps varint coded per row, usually one or two
+//                     bytes each, plus sizeof(W) for the weight; it adds a
+//                     byte offset per row, so it pays off once rows hold
+//                     more than a handful of entries
+//
+// Both keep the CSRMatrix invariants, expose the weight type as value_type
+// and visit a row with forEachInRow(r, f), decoding on the fly; kernels
+// written against forEachInRow accept any of the three forms and widen the
+// weights to their semiring's type as they read them. Row offsets stay
+// size_t, so only the number of columns is limited by I.
+
+namespace compact {
+
+// v as a W; throws std::range_error unless W can hold it. Integer weights
+// must convert exactly, floating point ones may round but must stay in
+// range and nonzero (zero would turn an edge into "absent").
+template <typename W, typename T> W narrowWeight(const T &v) {
+  if (v < T(std::numeric_limits<W>::lowest()) ||
+      v > T(std::numeric_limits<W>::max()))
+    throw std::range_error("weight " + std::to_string(v) +
+                           " does not fit the compact weight type");
+  W w = static_cast<W>(v);
+  if (std::numeric_limits<W>::is_integer ? T(w) != v : w == W(0))
+    throw std::range_error("weight " + std::to_string(v) +
+                           " is not representable in the compact weight type");
+  return w;
+}
+
+// LEB128: seven bits per byte, high bit set on all but the last byte
+inline void putVarint(std::vector<uint8_t> &out, size_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<uint8_t>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(v));
+}
+
+inline size_t getVarint(const uint8_t *&in) {
+  size_t v = *in & 0x7f;
+  for (unsigned shift = 7; *in++ & 0x80; shift += 7)
+    v |= size_t(*in & 0x7f) << shift;
+  return v;
+}
+
+} // namespace compact
+
+template <typename W, typename I = uint32_t> class CompactCSR {
+private:
+  size_t rows;
+  size_t cols;
+  std::vector<size_t> rowPtr;
+  std::vector<I> colIdx;
+  std::vector<W> values;
+
+public:
+  typedef W value_type;
+
+  CompactCSR() : rows(0), cols(0), rowPtr(1, 0) {}
+
+  // Throws std::range_error when cols or a weight does not fit I or W.
+  template <typename T> static CompactCSR<W, I> fromCSR(const CSRMatrix<T> &m) {
+    if (m.getNumCols() > size_t(std::numeric_limits<I>::max()) + 1)
+      throw std::range_error(std::to_string(m.getNumCols()) +
+                             " columns do not fit the compact index type");
+    CompactCSR<W, I> c;
+    c.rows = m.getNumRows();
+    c.cols = m.getNumCols();
+    c.rowPtr.assign(m.getRowPtr(), m.getRowPtr() + c.rows + 1);
+    c.colIdx.resize(m.nnz());
+    c.values.resize(m.nnz());
+    for (size_t p = 0; p < m.nnz(); p++) {
+      c.colIdx[p] = static_cast<I>(m.col(p));
+      c.values[p] = compact::narrowWeight<W>(m.value(p));
+    }
+    return c;
+  }
+
+  template <typename T> CSRMatrix<T> toCSR() const {
+    std::vector<size_t> idx(colIdx.begin(), colIdx.end());
+    std::vector<T> val(values.begin(), values.end());
+    return CSRMatrix<T>(rows, cols, rowPtr, std::move(idx), std::move(val));
+  }
+
+  size_t getNumRows() const { return rows; }
+  size_t getNumCols() const { return cols; }
+  size_t nnz() const { return rowPtr[rows]; }
+
+  size_t rowBegin(size_t r) const { return rowPtr[r]; }
+  size_t rowEnd(size_t r) const { return rowPtr[r + 1]; }
+  size_t rowSize(size_t r) const { return rowPtr[r + 1] - rowPtr[r]; }
+
+  size_t col(size_t p) const { return colIdx[p]; }
+  const W &value(size_t p) const { return values[p]; }
+
+  template <typename F> void forEachInRow(size_t r, F f) const {
+    for (size_t p = rowPtr[r]; p < rowPtr[r + 1]; p++)
+      f(size_t(colIdx[p]), values[p]);
+  }
+
+  size_t bytes() const {
+    return rowPtr.size() * sizeof(size_t) + colIdx.size() * sizeof(I) +
+           values.size() * sizeof(W);
+  }
+};
+
+// Row r's columns are stored as gaps from the previous column (the first
+// from 0), each a varint, starting at byte rowByte[r] of the stream. Only
+// sequential access within a row is possible, so there is no col(p).
+template <typename W> class PackedCSR {
+private:
+  size_t rows;
+  size_t cols;
+  std::vector<size_t> rowPtr;
+  std::vector<size_t> rowByte;
+  std::vector<uint8_t> stream;
+  std::vector<W> values;
+
+public:
+  typedef W value_type;
+
+  PackedCSR() : rows(0), cols(0), rowPtr(1, 0), rowByte(1, 0) {}
+
+  // Throws std::range_error when a weight does not fit W.
+  template <typename T> static PackedCSR<W> fromCSR(const CSRMatrix<T> &m) {
+    PackedCSR<W> c;
+    c.rows = m.getNumRows();
+    c.cols = m.getNumCols();
+    c.rowPtr.assign(m.getRowPtr(), m.getRowPtr() + c.rows + 1);
+    c.rowByte.resize(c.rows + 1);
+    c.values.resize(m.nnz());
+    c.stream.reserve(m.nnz() + m.nnz() / 2);
+    for (size_t i = 0; i < c.rows; i++) {
+      c.rowByte[i] = c.stream.size();
+      size_t last = 0;
+      for (size_t p = m.rowBegin(i); p < m.rowEnd(i); p++) {
+        compact::putVarint(c.stream, m.col(p) - last);
+        last = m.col(p);
+        c.values[p] = compact::narrowWeight<W>(m.value(p));
+      }
+    }
+    c.rowByte[c.rows] = c.stream.size();
+    c.stream.shrink_to_fit();
+    return c;
+  }
+
+  template <typename T> CSRMatrix<T> toCSR() const {
+    std::vector<size_t> idx(nnz());
+    std::vector<T> val(values.begin(), values.end());
+    for (size_t i = 0; i < rows; i++) {
+      size_t p = rowPtr[i];
+      forEachInRow(i, [&](size_t j, const W &) { idx[p++] = j; });
+    }
+    return CSRMatrix<T>(rows, cols, rowPtr, std::move(idx), std::move(val));
+  }
+
+  size_t getNumRows() const { return rows; }
+  size_t getNumCols() const { return cols; }
+  size_t nnz() const { return rowPtr[rows]; }
+
+  size_t rowBegin(size_t r) const { return rowPtr[r]; }
+  size_t rowEnd(size_t r) const { return rowPtr[r + 1]; }
+  size_t rowSize(size_t r) const { return rowPtr[r + 1] - rowPtr[r]; }
+
+  template <typename F> void forEachInRow(size_t r, F f) const {
+    const uint8_t *in = stream.data() + rowByte[r];
+    size_t j = 0;
+    for (size_t p = rowPtr[r]; p < rowPtr[r + 1]; p++) {
+      j += compact::getVarint(in);
+      f(j, values[p]);
+    }
+  }
+
+  size_t bytes() const {
+    return (rowPtr.size() + rowByte.size()) * sizeof(size_t) + stream.size() +
+           values.size() * sizeof(W);
+  }
+};
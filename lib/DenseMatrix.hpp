@@ -0,0 +1,56 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include <cassert>
+#include <vector>
+
+// Contiguous row-major matrix for the dense engines. Unlike the sparse
+// types it stores every cell, so "no entry" is the semiring's zero(); the
+// conversions take the semiring to map between the two conventions.
+template <typename T> class DenseMatrix {
+private:
+  size_t rows;
+  size_t cols;
+  std::vector<T> data;
+
+public:
+  DenseMatrix() : rows(0), cols(0) {}
+  DenseMatrix(size_t r, size_t c, const T &fill = T())
+      : rows(r), cols(c), data(r * c, fill) {}
+
+  template <typename S> static DenseMatrix<T> fromCSR(const CSRMatrix<T> &m) {
+    DenseMatrix<T> d(m.getNumRows(), m.getNumCols(), S::zero());
+    for (size_t i = 0; i < m.getNumRows(); i++) {
+      T *row = d.row(i);
+      for (size_t p = m.rowBegin(i); p < m.rowEnd(i); p++)
+        row[m.col(p)] = m.value(p);
+    }
+    return d;
+  }
+
+  template <typename S> CSRMatrix<T> toCSR() const {
+    size_t count = 0;
+    for (const T &v : data)
+      count += (v != S::zero() && v != T(0));
+
+    CSRBuilder<T> builder(rows, cols, count);
+    for (size_t i = 0; i < rows; i++) {
+      const T *r = row(i);
+      for (size_t j = 0; j < cols; j++) {
+        if (r[j] != S::zero())
+          builder.push(j, r[j]);
+      }
+      builder.finishRow();
+    }
+    return builder.build();
+  }
+
+  size_t getNumRows() const { return rows; }
+  size_t getNumCols() const { return cols; }
+
+  T *row(size_t i) { return data.data() + i * cols; }
+  const T *row(size_t i) const { return data.data() + i * cols; }
+
+  T &operator()(size_t i, size_t j) { return data[i * cols + j]; }
+  const T &operator()(size_t i, size_t j) const { return data[i * cols + j]; }
+};
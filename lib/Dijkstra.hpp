@@ -0,0 +1,182 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "Instrument.hpp"
+#include "SpGEMM.hpp"
+#include "SparseAccumulator.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// All-pairs closure as one label-setting (Dijkstra) search per source row,
+// the searches spread over the pool. A search costs about
+// r * (d + log r) for r reachable vertices of average degree d, so the
+// whole closure is n times that, against roughly n * r^2 per round for
+// squaring: on sparse, long-diameter graphs (paths, road networks) it does
+// orders of magnitude less work.
+//
+// Label setting needs a selective S (add returns one of its arguments, so
+// it orders labels) in which extending a path never makes it better:
+// add(one(), w) == one() for every weight w. MinPlus with nonnegative
+// weights, MaxMin and OrAnd qualify; dijkstraClosure checks the weights
+// and throws std::domain_error otherwise. Searches start from the
+// out-edges of the source, so the result equals squaringClosure<S>():
+// (i, i) is only set by a cycle.
+
+// True when every weight of a satisfies add(one(), w) == one().
+template <typename S, typename M> bool labelSettingApplies(const M &a) {
+  typedef typename S::value_type T;
+  typedef typename M::value_type W;
+  bool ok = true;
+  for (size_t i = 0; i < a.getNumRows() && ok; i++) {
+    a.forEachInRow(i, [&](size_t, const W &w) {
+      ok = ok && S::add(S::one(), T(w)) == S::one();
+    });
+  }
+  return ok;
+}
+
+// Per-worker scratch for dijkstraRow, reused across sources.
+template <typename T> struct DijkstraScratch {
+  SparseAccumulator<T> dist;
+  std::vector<char> settled;
+  std::vector<size_t> order; // vertices in the order they were settled
+  std::vector<std::pair<T, size_t>> heap; // stale entries are skipped
+
+  void resize(size_t n) {
+    if (dist.size() != n) {
+      dist.resize(n);
+      settled.assign(n, 0);
+    }
+  }
+
+  // bytes held for an n-column operand
+  static size_t footprint(size_t n) {
+    return n * (sizeof(T) + 2 * sizeof(char) + 2 * sizeof(size_t));
+  }
+};
+
+// Limits of a bounded search (see BoundedClosure.hpp): labels worse than
+// radius are never kept, and the search stops once limit vertices are
+// settled. The defaults bound nothing.
+template <typename T> struct SearchBounds {
+  bool hasRadius;
+  T radius;
+  size_t limit;
+
+  SearchBounds() : hasRadius(false), radius(), limit(size_t(-1)) {}
+
+  static SearchBounds within(const T &r) {
+    SearchBounds b;
+    b.hasRadius = true;
+    b.radius = r;
+    return b;
+  }
+
+  static SearchBounds nearest(size_t k) {
+    SearchBounds b;
+    b.limit = k;
+    return b;
+  }
+
+  // d is at least as good as the radius (d <= radius in min-plus)
+  template <typename S> bool admits(const T &d) const {
+    return !hasRadius || S::add(d, radius) == d;
+  }
+};
+
+// Leaves closure row i of a in s.dist and the vertices it reaches in
+// s.order; the caller flushes s.dist. improved(j, k) is called on every
+// improvement (see SparseAccumulator.hpp). Under bounds, only the
+// vertices in s.order (marked in s.settled) are final; s.dist also holds
+// labels the search stopped before settling.
+template <typename S, typename M, typename Improved = IgnoreImprovements>
+void dijkstraRow(const M &a, size_t i,
+                 DijkstraScratch<typename S::value_type> &s,
+                 Improved improved = Improved(),
+                 const SearchBounds<typename S::value_type> &bounds =
+                     SearchBounds<typename S::value_type>()) {
+  typedef typename S::value_type T;
+  typedef typename M::value_type W;
+  auto add = [](const T &x, const T &y) { return S::add(x, y); };
+  // std heaps keep the largest on top; "larger" here is better
+  auto worse = [](const std::pair<T, size_t> &x,
+                  const std::pair<T, size_t> &y) {
+    return x.first != y.first && S::add(x.first, y.first) == y.first;
+  };
+  auto push = [&](const T &d, size_t j) {
+    s.heap.push_back(std::make_pair(d, j));
+    std::push_heap(s.heap.begin(), s.heap.end(), worse);
+  };
+
+  for (size_t k : s.order)
+    s.settled[k] = 0;
+  s.order.clear();
+  s.heap.clear();
+  a.forEachInRow(i, [&](size_t j, const W &w) {
+    if (bounds.template admits<S>(T(w)) && s.dist.improve(j, T(w), add)) {
+      improved(j, fromSource);
+      push(T(w), j);
+    }
+  });
+
+  while (!s.heap.empty() && s.order.size() < bounds.limit) {
+    std::pop_heap(s.heap.begin(), s.heap.end(), worse);
+    const T d = s.heap.back().first;
+    const size_t k = s.heap.back().second;
+    s.heap.pop_back();
+    if (s.settled[k])
+      continue;
+    s.settled[k] = 1;
+    s.order.push_back(k);
+    a.forEachInRow(k, [&](size_t j, const W &w) {
+      if (!s.settled[j]) {
+        T v = S::mul(d, T(w));
+        if (bounds.template admits<S>(v) && s.dist.improve(j, v, add)) {
+          improved(j, k);
+          push(v, j);
+        }
+      }
+    });
+  }
+}
+
+template <typename S, typename M>
+CSRMatrix<typename S::value_type> dijkstraClosure(const M &a,
+                                                  thread_pool *pool = nullptr) {
+  typedef typename S::value_type T;
+  static_assert(S::idempotent, "label setting needs an idempotent S");
+  assert(a.getNumRows() == a.getNumCols());
+  if (!labelSettingApplies<S>(a))
+    throw std::domain_error("dijkstraClosure: a weight would improve the "
+                            "paths it extends (negative min-plus weight?)");
+  MATRICES_PHASE("closure.dijkstra");
+  size_t n = a.getNumRows();
+
+  std::vector<std::vector<size_t>> rowCols(n);
+  std::vector<std::vector<T>> rowVals(n);
+  std::vector<DijkstraScratch<T>> scratch(workerSlots(pool));
+
+  forEachRange(pool, n, [&](size_t begin, size_t end) {
+    DijkstraScratch<T> &s = scratch[workerSlot(pool)];
+    s.resize(n);
+    for (size_t i = begin; i < end; i++) {
+      dijkstraRow<S>(a, i, s);
+      auto &c = rowCols[i];
+      auto &v = rowVals[i];
+      c.reserve(s.dist.nnz());
+      v.reserve(s.dist.nnz());
+      s.dist.flush([&c, &v](size_t col, const T &value) {
+        if (value != T(0)) {
+          c.push_back(col);
+          v.push_back(value);
+        }
+      });
+    }
+  });
+
+  return concatRows(n, rowCols, rowVals, pool);
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "Instrument.hpp"
+#include "MappedFile.hpp"
+#include "SparseMatrix.hpp"
+#include "ThreadPool.hpp"
+#include "Triplets.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Parallel loader for DIMACS shortest-path files ("p sp <nodes> <arcs>"
+// header, "a <from> <to> <weight>" arcs with 1-based nodes, "c" comments).
+// The file is memory-mapped and cut into chunks at newline boundaries;
+// chunks are parsed on the pool with hand-rolled number parsers, and the
+// arcs go through csrFromTriplets to be sorted, deduplicated and built in
+// bulk as CSR.
+//
+// Duplicate arcs keep the largest weight, as the old std::set + set()
+// loader did. Arcs that name a node outside the header's range are
+// skipped and counted instead of aborting the load.
+
+struct DimacsStats {
+  size_t bytes;
+  size_t nodes;
+  size_t arcs;       // arcs in the matrix
+  size_t parsed;     // "a" lines read
+  size_t duplicates; // arcs dropped as duplicates
+  size_t skipped;    // arcs dropped for being out of range
+  double parseSeconds;
+  double totalSeconds;
+
+  DimacsStats()
+      : bytes(0), nodes(0), arcs(0), parsed(0), duplicates(0), skipped(0),
+        parseSeconds(0), totalSeconds(0) {}
+
+  double parseMBps() const {
+    return parseSeconds > 0 ? bytes / parseSeconds / 1e6 : 0;
+  }
+};
+
+namespace dimacs {
+
+inline std::runtime_error parseError(const char *base, const char *at,
+                                     const std::string &what) {
+  return std::runtime_error("DIMACS parse error at byte " +
+                            std::to_string(at - base) + ": " + what);
+}
+
+inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline const char *skipBlanks(const char *p, const char *end) {
+  while (p < end && isBlank(*p))
+    p++;
+  return p;
+}
+
+inline bool parseUnsigned(const char *&p, const char *end, size_t &out) {
+  p = skipBlanks(p, end);
+  if (p == end || *p < '0' || *p > '9')
+    return false;
+  size_t v = 0;
+  while (p < end && *p >= '0' && *p <= '9')
+    v = v * 10 + size_t(*p++ - '0');
+  out = v;
+  return true;
+}
+
+// Decimal parser. Mantissas below 2^53 with a small power of ten are
+// exact, since both are exactly representable and one multiplication or
+// division rounds correctly; anything else goes through strtod.
+template <typename T>
+inline bool parseNumber(const char *&p, const char *end, T &out) {
+  static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+  p = skipBlanks(p, end);
+  const char *start = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+  unsigned long long mantissa = 0;
+  int digits = 0, scale = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    mantissa = mantissa * 10 + unsigned(*p++ - '0');
+    digits++;
+  }
+  if (p < end && *p == '.') {
+    p++;
+    while (p < end && *p >= '0' && *p <= '9') {
+      mantissa = mantissa * 10 + unsigned(*p++ - '0');
+      digits++;
+      scale--;
+    }
+  }
+  if (digits == 0)
+    return false;
+  bool exponent = p < end && (*p == 'e' || *p == 'E');
+  if (!exponent && digits <= 15 && scale >= -22) {
+    double v = scale ? double(mantissa) / pow10[-scale] : double(mantissa);
+    out = T(negative ? -v : v);
+    return true;
+  }
+  // rare slow path; the token ends at the next blank or newline
+  std::string token(start, p);
+  while (p < end && !isBlank(*p) && *p != '\n')
+    token += *p++;
+  out = T(std::strtod(token.c_str(), nullptr));
+  return true;
+}
+
+template <typename T> struct Chunk {
+  std::vector<Triplet<T>> arcs;
+  bool hasHeader = false;
+  size_t nodes = 0;
+  size_t declaredArcs = 0;
+};
+
+template <typename T>
+void parseChunk(const char *base, const char *p, const char *end,
+                Chunk<T> &chunk) {
+  while (p < end) {
+    const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+    if (!eol)
+      eol = end;
+    const char *q = skipBlanks(p, eol);
+    if (q < eol) {
+      if (*q == 'a') {
+        Triplet<T> arc;
+        q++;
+        if (!parseUnsigned(q, eol, arc.row) ||
+            !parseUnsigned(q, eol, arc.col) ||
+            !parseNumber(q, eol, arc.value) || arc.row == 0 || arc.col == 0)
+          throw parseError(base, p, "malformed arc line");
+        arc.row--;
+        arc.col--;
+        chunk.arcs.push_back(arc);
+      } else if (*q == 'p') {
+        q = skipBlanks(q + 1, eol);
+        // only the shortest-path problem type is meaningful here
+        if (eol - q >= 2 && q[0] == 's' && q[1] == 'p') {
+          q += 2;
+          if (!parseUnsigned(q, eol, chunk.nodes) ||
+              !parseUnsigned(q, eol, chunk.declaredArcs))
+            throw parseError(base, p, "malformed problem line");
+          chunk.hasHeader = true;
+        }
+      }
+      // "c" comments and unknown lines are ignored
+    }
+    p = eol + 1;
+  }
+}
+
+} // namespace dimacs
+
+template <typename T>
+CSRMatrix<T> loadDimacsCSR(const std::string &path, thread_pool &pool,
+                           DimacsStats *stats = nullptr) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  MappedFile file(path);
+  file.advise(MADV_SEQUENTIAL);
+  const char *base = file.data();
+  size_t size = file.size();
+
+  // chunk boundaries, each moved forward to the start of the next line
+  size_t chunks = std::max<size_t>(1, std::min(4 * (pool.size() + 1),
+                                                size / (64 * 1024)));
+  std::vector<size_t> bounds(chunks + 1, size);
+  bounds[0] = 0;
+  for (size_t c = 1; c < chunks; c++) {
+    size_t b = size * c / chunks;
+    const void *nl = memchr(base + b, '\n', size - b);
+    bounds[c] = nl ? static_cast<const char *>(nl) - base + 1 : size;
+    bounds[c] = std::max(bounds[c], bounds[c - 1]);
+  }
+
+  std::vector<dimacs::Chunk<T>> parsed(chunks);
+  {
+    MATRICES_PHASE("dimacs.parse");
+    pool.parallel_for(0, chunks, 1, [&](size_t begin, size_t end) {
+      for (size_t c = begin; c < end; c++)
+        dimacs::parseChunk(base, base + bounds[c], base + bounds[c + 1],
+                           parsed[c]);
+    });
+  }
+
+  DimacsStats st;
+  st.bytes = size;
+  bool hasHeader = false;
+  size_t total = 0;
+  for (const auto &c : parsed) {
+    if (c.hasHeader && !hasHeader) {
+      hasHeader = true;
+      st.nodes = c.nodes;
+    }
+    total += c.arcs.size();
+  }
+  if (!hasHeader)
+    throw std::runtime_error("DIMACS file " + path + " has no 'p sp' line");
+
+  // arcs naming a node past the header's count are dropped here
+  size_t n = st.nodes;
+  std::vector<Triplet<T>> arcs;
+  arcs.reserve(total);
+  for (auto &c : parsed) {
+    for (const Triplet<T> &a : c.arcs) {
+      if (a.row < n && a.col < n)
+        arcs.push_back(a);
+    }
+    st.parsed += c.arcs.size();
+    std::vector<Triplet<T>>().swap(c.arcs);
+  }
+  st.skipped = st.parsed - arcs.size();
+  st.parseSeconds = std::chrono::duration_cast<std::chrono::duration<double>>(
+                        std::chrono::high_resolution_clock::now() - start)
+                        .count();
+
+  // duplicate arcs keep the heaviest weight, zero weights mean no arc
+  CSRMatrix<T> result = csrFromTriplets(
+      n, n, std::move(arcs),
+      [](const T &x, const T &y) { return std::max(x, y); }, &pool,
+      &st.duplicates);
+  st.arcs = result.nnz();
+  st.totalSeconds = std::chrono::duration_cast<std::chrono::duration<double>>(
+                        std::chrono::high_resolution_clock::now() - start)
+                        .count();
+  if (stats)
+    *stats = st;
+  return result;
+}
+
+template <typename T>
+SparseMatrix<T> loadDimacs(const std::string &path, thread_pool &pool,
+                           DimacsStats *stats = nullptr) {
+  return SparseMatrix<T>(loadDimacsCSR<T>(path, pool, stats));
+}
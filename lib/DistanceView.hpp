@@ -0,0 +1,245 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "Dijkstra.hpp"
+#include "Instrument.hpp"
+#include "SemiNaive.hpp"
+#include "SpGEMM.hpp"
+#include "SparseMatrix.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Lazy view of the closure of A over S: row i of the closure (the best
+// paths out of source i) is computed the first time it is asked for and
+// kept in an LRU cache bounded in bytes, so a few hundred sources on a
+// large graph cost a few hundred searches instead of the whole n x n
+// result. Rows come from a Dijkstra search when label setting applies to
+// the weights, from semi-naive relaxation otherwise, and match the
+// corresponding rows of squaringClosure<S>().
+//
+// Rows are handed out as shared pointers, so a row stays valid after the
+// cache evicts it. All members are safe to call from several threads: a
+// search checks its scratch out of a shared idle list for its duration,
+// so concurrent row() and rows() calls, even on one pool, never share it.
+
+template <typename T> struct DistanceRow {
+  std::vector<size_t> cols; // ascending
+  std::vector<T> vals;
+
+  size_t nnz() const { return cols.size(); }
+
+  // T(0) when there is no path, like the sparse matrices
+  T get(size_t j) const {
+    auto it = std::lower_bound(cols.begin(), cols.end(), j);
+    if (it != cols.end() && *it == j)
+      return vals[it - cols.begin()];
+    return T(0);
+  }
+
+  size_t bytes() const {
+    return sizeof(*this) + cols.capacity() * sizeof(size_t) +
+           vals.capacity() * sizeof(T);
+  }
+};
+
+struct DistanceCacheStats {
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+  size_t rows;  // currently cached
+  size_t bytes; // currently cached
+
+  DistanceCacheStats() : hits(0), misses(0), evictions(0), rows(0), bytes(0) {}
+};
+
+template <typename S> class DistanceView {
+public:
+  typedef typename S::value_type T;
+  typedef std::shared_ptr<const DistanceRow<T>> RowPtr;
+
+private:
+  struct Scratch {
+    DijkstraScratch<T> dijkstra;
+    SemiNaiveScratch<T> semiNaive;
+  };
+
+  struct Entry {
+    RowPtr row;
+    std::list<size_t>::iterator use;
+  };
+
+  CSRMatrix<T> a;
+  bool labelSetting;
+  size_t budget;
+
+  mutable std::mutex m;
+  std::list<size_t> lru; // most recently used first
+  std::unordered_map<size_t, Entry> cache;
+  std::vector<std::unique_ptr<Scratch>> idle; // scratch not in use
+  DistanceCacheStats stats;
+
+  RowPtr compute(size_t i, Scratch &s) const {
+    std::shared_ptr<DistanceRow<T>> row = std::make_shared<DistanceRow<T>>();
+    SparseAccumulator<T> *dist;
+    if (labelSetting) {
+      s.dijkstra.resize(a.getNumCols());
+      dijkstraRow<S>(a, i, s.dijkstra);
+      dist = &s.dijkstra.dist;
+    } else {
+      s.semiNaive.resize(a.getNumCols());
+      semiNaiveRow<S>(a, i, s.semiNaive);
+      dist = &s.semiNaive.dist;
+    }
+    row->cols.reserve(dist->nnz());
+    row->vals.reserve(dist->nnz());
+    dist->flush([&row](size_t col, const T &value) {
+      if (value != T(0)) {
+        row->cols.push_back(col);
+        row->vals.push_back(value);
+      }
+    });
+    return row;
+  }
+
+  // Scratch nobody else is using; hand it back with release().
+  std::unique_ptr<Scratch> acquire() {
+    {
+      std::lock_guard<std::mutex> lk(m);
+      if (!idle.empty()) {
+        std::unique_ptr<Scratch> s = std::move(idle.back());
+        idle.pop_back();
+        return s;
+      }
+    }
+    return std::unique_ptr<Scratch>(new Scratch());
+  }
+
+  void release(std::unique_ptr<Scratch> s) {
+    std::lock_guard<std::mutex> lk(m);
+    idle.push_back(std::move(s));
+  }
+
+  // Caller holds m. Marks i as just used.
+  RowPtr lookup(size_t i) {
+    auto it = cache.find(i);
+    if (it == cache.end())
+      return RowPtr();
+    lru.splice(lru.begin(), lru, it->second.use);
+    stats.hits++;
+    return it->second.row;
+  }
+
+  // Caller holds m. A row larger than the whole budget is not cached.
+  void insert(size_t i, const RowPtr &row) {
+    if (cache.count(i) || row->bytes() > budget)
+      return;
+    lru.push_front(i);
+    cache[i] = Entry{row, lru.begin()};
+    stats.rows++;
+    stats.bytes += row->bytes();
+    while (stats.bytes > budget) {
+      auto victim = cache.find(lru.back());
+      stats.bytes -= victim->second.row->bytes();
+      stats.rows--;
+      stats.evictions++;
+      cache.erase(victim);
+      lru.pop_back();
+    }
+  }
+
+public:
+  // a must be square; cacheBytes bounds the rows kept, not the operand.
+  explicit DistanceView(CSRMatrix<T> op, size_t cacheBytes = size_t(64) << 20)
+      : a(std::move(op)), labelSetting(labelSettingApplies<S>(a)),
+        budget(cacheBytes) {
+    static_assert(S::idempotent, "distance rows need an idempotent S");
+    assert(a.getNumRows() == a.getNumCols());
+  }
+
+  explicit DistanceView(const SparseMatrix<T> &m,
+                        size_t cacheBytes = size_t(64) << 20)
+      : DistanceView(m.toCSR(), cacheBytes) {}
+
+  size_t getNumRows() const { return a.getNumRows(); }
+  size_t getNumCols() const { return a.getNumCols(); }
+  size_t cacheBudget() const { return budget; }
+
+  DistanceCacheStats cacheStats() const {
+    std::lock_guard<std::mutex> lk(m);
+    return stats;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lk(m);
+    cache.clear();
+    lru.clear();
+    stats.rows = stats.bytes = 0;
+  }
+
+  // Row i of the closure, computed on the calling thread on a miss.
+  RowPtr row(size_t i) {
+    assert(i < a.getNumRows());
+    {
+      std::lock_guard<std::mutex> lk(m);
+      RowPtr hit = lookup(i);
+      if (hit)
+        return hit;
+      stats.misses++;
+    }
+    std::unique_ptr<Scratch> s = acquire();
+    RowPtr row = compute(i, *s);
+    release(std::move(s));
+    std::lock_guard<std::mutex> lk(m);
+    insert(i, row);
+    return row;
+  }
+
+  T get(size_t i, size_t j) { return row(i)->get(j); }
+
+  // Rows for every source in sources, in the same order; the misses are
+  // computed concurrently on the pool, one search per task.
+  std::vector<RowPtr> rows(const std::vector<size_t> &sources,
+                           thread_pool *pool = nullptr) {
+    MATRICES_PHASE("distances.batch");
+    std::vector<RowPtr> out(sources.size());
+    std::vector<size_t> missing;
+    {
+      std::lock_guard<std::mutex> lk(m);
+      for (size_t k = 0; k < sources.size(); k++) {
+        assert(sources[k] < a.getNumRows());
+        out[k] = lookup(sources[k]);
+        if (!out[k])
+          missing.push_back(sources[k]);
+      }
+      std::sort(missing.begin(), missing.end());
+      missing.erase(std::unique(missing.begin(), missing.end()),
+                    missing.end());
+      stats.misses += missing.size();
+    }
+
+    std::vector<RowPtr> computed(missing.size());
+    forEachRange(pool, missing.size(), [&](size_t begin, size_t end) {
+      std::unique_ptr<Scratch> s = acquire();
+      for (size_t k = begin; k < end; k++)
+        computed[k] = compute(missing[k], *s);
+      release(std::move(s));
+    });
+
+    std::lock_guard<std::mutex> lk(m);
+    for (size_t k = 0; k < missing.size(); k++)
+      insert(missing[k], computed[k]);
+    for (size_t k = 0; k < sources.size(); k++) {
+      if (!out[k])
+        out[k] = computed[std::lower_bound(missing.begin(), missing.end(),
+                                           sources[k]) -
+                          missing.begin()];
+    }
+    return out;
+  }
+};
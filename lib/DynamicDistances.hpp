@@ -0,0 +1,246 @@
+#pragma once
+
+#include "Dijkstra.hpp"
+#include "Instrument.hpp"
+#include "SparseMatrix.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// All-pairs closure kept up to date under arc updates, instead of
+// recomputing it after every change.
+//
+// Decreases and insertions are applied in place. A new best path uses the
+// changed arc (u, v) at most once, so it is a best path to u, the arc,
+// then a best path out of v, and only pairs (i, j) with i reaching u and
+// v reaching j can change. Sources whose path to v does not improve are
+// skipped outright, because a better path to any j would improve v first.
+//
+// Increases and deletions can only hurt pairs whose best path used the
+// arc. By subpath optimality such a source i also has a best path to v
+// through (u, v), which is checked in O(1), and only those rows are
+// recomputed by Dijkstra searches on the pool. Floating-point distances
+// summed in another order (by the squaring engine, or by earlier
+// decreases) may differ from d(i, u) + old in the last bits, so the check
+// treats values within a relative 1e-9 as a tie. It errs towards
+// recomputing: only a source whose path to v is clearly better than the
+// one through the arc is kept.
+//
+// Both rules need label setting (see Dijkstra.hpp), so the arcs and every
+// update must satisfy it. The closure is kept together with its transpose
+// in the map-based form. Column u of the closure gives the sources that
+// reach u, and every changed pair costs O(log n). The total cost tracks
+// the number of affected pairs, not the size of the graph.
+
+template <typename T> struct ArcUpdate {
+  size_t from;
+  size_t to;
+  T weight; // T(0) deletes the arc, as in SparseMatrix::set
+};
+
+struct DynamicDistancesStats {
+  size_t updates;
+  size_t decreases;      // including insertions
+  size_t increases;      // including deletions
+  size_t pairsChanged;   // by decreases
+  size_t rowsRecomputed; // by increases
+
+  DynamicDistancesStats()
+      : updates(0), decreases(0), increases(0), pairsChanged(0),
+        rowsRecomputed(0) {}
+};
+
+template <typename S> class DynamicDistances {
+public:
+  typedef typename S::value_type T;
+
+private:
+  SparseMatrix<T> a;  // current arcs
+  SparseMatrix<T> d;  // closure of a
+  SparseMatrix<T> dt; // transpose of d
+  DynamicDistancesStats counts;
+
+  static bool better(const T &x, const T &than) {
+    return than == T(0) || (x != than && S::add(x, than) == x);
+  }
+
+  // x and y equal up to rounding
+  static bool tie(const T &x, const T &y, std::true_type) {
+    return std::fabs(x - y) <= 1e-9 * std::max(std::fabs(x), std::fabs(y));
+  }
+  static bool tie(const T &x, const T &y, std::false_type) { return x == y; }
+
+  // the best path from i to v may run through an arc that took i to u in
+  // toU and weighed old
+  bool mayUse(size_t i, const T &toU, const T &old, size_t v) const {
+    T through = S::mul(toU, old), best = d.get(i, v);
+    return best != T(0) && (!better(best, through) ||
+                            tie(best, through, std::is_floating_point<T>()));
+  }
+
+  static void check(const T &w) {
+    if (w != T(0) && S::add(S::one(), w) != S::one())
+      throw std::domain_error("DynamicDistances: weight would improve the "
+                              "paths it extends (negative min-plus weight?)");
+  }
+
+  void put(size_t i, size_t j, const T &value) {
+    d.set(value, i, j);
+    dt.set(value, j, i);
+  }
+
+  // u -> v now has the better weight w
+  void decrease(size_t u, size_t v, const T &w) {
+    // best paths into u (the empty one first) and out of v, taken before
+    // any change: the new arc is used at most once
+    std::vector<std::pair<size_t, T>> into(1, std::make_pair(u, S::one()));
+    into.insert(into.end(), dt(u).begin(), dt(u).end());
+    std::vector<std::pair<size_t, T>> out(1, std::make_pair(v, S::one()));
+    out.insert(out.end(), d(v).begin(), d(v).end());
+
+    for (const auto &src : into) {
+      size_t i = src.first;
+      T via = S::mul(src.second, w);
+      if (!better(via, d.get(i, v)))
+        continue;
+      for (const auto &dst : out) {
+        T candidate = S::mul(via, dst.second);
+        if (better(candidate, d.get(i, dst.first))) {
+          put(i, dst.first, candidate);
+          counts.pairsChanged++;
+        }
+      }
+    }
+  }
+
+  void recompute(const std::vector<size_t> &sources, thread_pool *pool) {
+    std::vector<std::vector<std::pair<size_t, T>>> fresh(sources.size());
+    std::vector<DijkstraScratch<T>> scratch(workerSlots(pool));
+    forEachRange(pool, sources.size(), [&](size_t begin, size_t end) {
+      DijkstraScratch<T> &s = scratch[workerSlot(pool)];
+      s.resize(a.getNumCols());
+      for (size_t k = begin; k < end; k++) {
+        dijkstraRow<S>(a, sources[k], s);
+        auto &row = fresh[k];
+        s.dist.flush([&row](size_t col, const T &value) {
+          if (value != T(0))
+            row.push_back(std::make_pair(col, value));
+        });
+      }
+    });
+
+    for (size_t k = 0; k < sources.size(); k++) {
+      size_t i = sources[k];
+      std::vector<size_t> gone;
+      auto next = fresh[k].begin();
+      for (const auto &old : d(i)) {
+        while (next != fresh[k].end() && next->first < old.first)
+          ++next;
+        if (next == fresh[k].end() || next->first != old.first)
+          gone.push_back(old.first);
+      }
+      for (size_t j : gone)
+        put(i, j, T(0));
+      for (const auto &e : fresh[k])
+        put(i, e.first, e.second);
+    }
+    counts.rowsRecomputed += sources.size();
+  }
+
+public:
+  // Takes the closure of arcs as already computed, e.g. by diamond().
+  DynamicDistances(const SparseMatrix<T> &arcs, const SparseMatrix<T> &closure)
+      : a(arcs), d(closure), dt(closure.getNumCols(), closure.getNumRows()) {
+    static_assert(S::idempotent, "incremental closure needs an idempotent S");
+    assert(arcs.getNumRows() == arcs.getNumCols());
+    assert(closure.getNumRows() == arcs.getNumRows() &&
+           closure.getNumCols() == arcs.getNumCols());
+    if (!labelSettingApplies<S>(a))
+      throw std::domain_error("DynamicDistances: a weight would improve the "
+                              "paths it extends (negative min-plus weight?)");
+    for (size_t i = 0; i < d.getNumRows(); i++) {
+      for (const auto &e : d(i))
+        dt.set(e.second, e.first, i);
+    }
+  }
+
+  // Computes the closure itself. Label setting is required anyway, so this
+  // is always one Dijkstra search per row, never the squaring engine.
+  explicit DynamicDistances(const SparseMatrix<T> &arcs,
+                            thread_pool *pool = nullptr)
+      : DynamicDistances(arcs, SparseMatrix<T>(dijkstraClosure<S>(
+                                   arcs.toCSR(), pool))) {}
+
+  const SparseMatrix<T> &arcs() const { return a; }
+  const SparseMatrix<T> &distances() const { return d; }
+  T get(size_t i, size_t j) const { return d.get(i, j); }
+  DynamicDistancesStats stats() const { return counts; }
+
+  // Applies a batch of arc updates; of several updates to one arc the last
+  // wins. Increases and deletions go first, as one parallel recomputation
+  // of every row they may have hurt; then each decrease is applied in place.
+  void apply(std::vector<ArcUpdate<T>> batch, thread_pool *pool = nullptr) {
+    MATRICES_PHASE("distances.update");
+    for (const ArcUpdate<T> &e : batch) {
+      assert(e.from < a.getNumRows() && e.to < a.getNumCols());
+      check(e.weight);
+    }
+    counts.updates += batch.size();
+    std::stable_sort(batch.begin(), batch.end(),
+                     [](const ArcUpdate<T> &x, const ArcUpdate<T> &y) {
+                       return x.from != y.from ? x.from < y.from : x.to < y.to;
+                     });
+    auto last = batch.begin();
+    for (auto it = batch.begin(); it != batch.end(); ++it) {
+      if (last != batch.begin() && (last - 1)->from == it->from &&
+          (last - 1)->to == it->to)
+        *(last - 1) = *it;
+      else
+        *last++ = *it;
+    }
+    batch.erase(last, batch.end());
+
+    std::vector<char> hurt(a.getNumRows(), 0);
+    std::vector<size_t> sources;
+    std::vector<ArcUpdate<T>> decreases;
+    for (const ArcUpdate<T> &e : batch) {
+      T old = a.get(e.from, e.to);
+      if (e.weight == old)
+        continue;
+      if (old == T(0) || (e.weight != T(0) && better(e.weight, old))) {
+        decreases.push_back(e);
+        continue;
+      }
+      counts.increases++;
+      a.set(e.weight, e.from, e.to);
+      // sources with a best path to v through u -> v, the empty one first
+      auto hit = [&](size_t i, const T &toU) {
+        if (!hurt[i] && mayUse(i, toU, old, e.to)) {
+          hurt[i] = 1;
+          sources.push_back(i);
+        }
+      };
+      hit(e.from, S::one());
+      for (const auto &src : dt(e.from))
+        hit(src.first, src.second);
+    }
+    if (!sources.empty())
+      recompute(sources, pool);
+
+    for (const ArcUpdate<T> &e : decreases) {
+      counts.decreases++;
+      a.set(e.weight, e.from, e.to);
+      decrease(e.from, e.to, e.weight);
+    }
+  }
+
+  // One update, with the argument order of SparseMatrix::set.
+  void set(T value, size_t r, size_t c, thread_pool *pool = nullptr) {
+    apply(std::vector<ArcUpdate<T>>(1, ArcUpdate<T>{r, c, value}), pool);
+  }
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "DenseMatrix.hpp"
+#include "Instrument.hpp"
+#include "Semiring.hpp"
+#include "SpGEMM.hpp"
+#include "ThreadPool.hpp"
+#include "TileKernel.hpp"
+#include <algorithm>
+#include <cassert>
+
+// C (+)= A (x) B on tiles of one row-major matrix with leading dimension
+// ld; C is m x nn and the shared dimension is kk. k is the outermost loop,
+// which keeps the update correct when C aliases A or B, as it does in the
+// first two Floyd-Warshall phases.
+template <typename S, typename T>
+inline void tileUpdate(T *c, const T *a, const T *b, size_t m, size_t kk,
+                       size_t nn, size_t ld) {
+  for (size_t k = 0; k < kk; k++) {
+    const T *bk = b + k * ld;
+    for (size_t i = 0; i < m; i++) {
+      const T aik = a[i * ld + k];
+      if (aik == S::zero())
+        continue;
+      T *ci = c + i * ld;
+      for (size_t j = 0; j < nn; j++)
+        ci[j] = S::add(ci[j], S::mul(aik, bk[j]));
+    }
+  }
+}
+
+// In-place blocked Floyd-Warshall over an idempotent semiring. For every
+// diagonal tile kb:
+//   1. close the diagonal tile itself,
+//   2. update the tiles in row kb and column kb from it (in parallel),
+//   3. update every remaining tile (i, j) with (i, kb) (x) (kb, j)
+//      (in parallel, on the SIMD micro-kernel since nothing aliases).
+// The diagonal is not seeded with one(), so like closure<S>() entry (i, i)
+// ends up as the best cycle through i, not the empty path.
+template <typename S, typename T>
+void floydWarshall(DenseMatrix<T> &d, thread_pool *pool = nullptr,
+                   size_t tile = 64) {
+  static_assert(S::idempotent, "Floyd-Warshall needs an idempotent semiring");
+  assert(d.getNumRows() == d.getNumCols());
+  MATRICES_PHASE("floydWarshall");
+  size_t n = d.getNumRows();
+  if (n == 0)
+    return;
+  size_t nb = (n + tile - 1) / tile;
+  T *base = d.row(0);
+
+  auto at = [base, tile, n](size_t bi, size_t bj) {
+    return base + bi * tile * n + bj * tile;
+  };
+  auto len = [tile, n](size_t b) { return std::min(tile, n - b * tile); };
+
+  for (size_t kb = 0; kb < nb; kb++) {
+    T *diag = at(kb, kb);
+    size_t kl = len(kb);
+    tileUpdate<S>(diag, diag, diag, kl, kl, kl, n);
+
+    forEachRange(pool, 2 * nb, [&](size_t begin, size_t end) {
+      for (size_t x = begin; x < end; x++) {
+        size_t other = x / 2;
+        if (other == kb)
+          continue;
+        if (x % 2 == 0) {
+          T *c = at(kb, other);
+          tileUpdate<S>(c, diag, c, kl, kl, len(other), n);
+        } else {
+          T *c = at(other, kb);
+          tileUpdate<S>(c, c, diag, len(other), kl, kl, n);
+        }
+      }
+    });
+
+    forEachRange(pool, nb * nb, [&](size_t begin, size_t end) {
+      for (size_t x = begin; x < end; x++) {
+        size_t bi = x / nb, bj = x % nb;
+        if (bi == kb || bj == kb)
+          continue;
+        tileMultiplyAdd<S>(at(bi, bj), n, at(bi, kb), n, at(kb, bj), n,
+                           len(bi), kl, len(bj));
+      }
+    });
+  }
+}
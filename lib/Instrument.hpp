@@ -0,0 +1,273 @@
+#pragma once
+
+// Opt-in instrumentation for the pool and the kernels. Compiled out unless
+// MATRICES_INSTRUMENT is defined (make INSTRUMENT=1); then the macros below
+// record
+//   - wall time and call count per named phase,
+//   - named event counters (partial products, output nnz, ...),
+//   - one line per squaring round of the closure,
+//   - tasks, steals, busy and idle time per pool worker,
+//   - with MATRICES_PERF=1 in the environment, process-wide hardware
+//     counters from perf_event_open (Linux),
+// and a compact report goes to stderr when the program exits.
+//
+//   MATRICES_PHASE("name");        times the rest of the enclosing scope
+//   MATRICES_COUNT("name", n);     adds n to a counter
+//   MATRICES_INSTRUMENTED(code)    code that only exists in instrumented
+//                                  builds, e.g. local tallies
+
+#ifdef MATRICES_INSTRUMENT
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace instrument {
+
+typedef std::chrono::steady_clock Clock;
+
+inline double seconds(Clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::duration<double>>(
+             Clock::now() - since)
+      .count();
+}
+
+struct PhaseStats {
+  uint64_t calls = 0;
+  double seconds = 0;
+};
+
+// Written only by the worker it belongs to; merged when the pool shuts
+// down.
+struct WorkerStats {
+  uint64_t tasks = 0;
+  uint64_t steals = 0;
+  double busySeconds = 0;
+  double idleSeconds = 0; // spinning or asleep
+};
+
+struct RoundStats {
+  size_t nnzIn;
+  size_t products;
+  size_t nnzOut;
+  double seconds;
+};
+
+// Hardware counters for the whole process, inherited by threads created
+// after they are opened.
+class PerfCounters {
+private:
+  struct Event {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+  };
+  std::vector<Event> events;
+
+public:
+  PerfCounters() {
+#ifdef __linux__
+    const char *env = std::getenv("MATRICES_PERF");
+    if (!env || std::strcmp(env, "1") != 0)
+      return;
+    Event wanted[] = {
+        {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+        {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+        {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1},
+        {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,
+         -1}};
+    for (Event &e : wanted) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = e.type;
+      attr.config = e.config;
+      attr.inherit = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      e.fd = static_cast<int>(
+          syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+      if (e.fd >= 0)
+        events.push_back(e);
+    }
+    if (events.empty())
+      std::fprintf(stderr, "instrument: perf_event_open unavailable\n");
+#endif
+  }
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (Event &e : events)
+      close(e.fd);
+#endif
+  }
+
+  void report(std::FILE *out) const {
+#ifdef __linux__
+    if (events.empty())
+      return;
+    std::fprintf(out, "hardware counters (user space, all threads):\n");
+    uint64_t cycles = 0, instructions = 0;
+    for (const Event &e : events) {
+      uint64_t value = 0;
+      if (read(e.fd, &value, sizeof(value)) != sizeof(value))
+        continue;
+      std::fprintf(out, "  %-16s %16llu\n", e.name,
+                   static_cast<unsigned long long>(value));
+      if (e.config == PERF_COUNT_HW_CPU_CYCLES)
+        cycles = value;
+      if (e.config == PERF_COUNT_HW_INSTRUCTIONS)
+        instructions = value;
+    }
+    if (cycles)
+      std::fprintf(out, "  %-16s %16.2f\n", "IPC",
+                   double(instructions) / cycles);
+#else
+    (void)out;
+#endif
+  }
+};
+
+class Registry {
+private:
+  std::mutex m;
+  std::map<std::string, PhaseStats> phases;
+  std::map<std::string, uint64_t> counters;
+  std::vector<RoundStats> rounds;
+  std::vector<WorkerStats> workers;
+  uint64_t pools = 0;
+  PerfCounters perf;
+
+public:
+  ~Registry() {
+    if (!phases.empty() || !counters.empty() || pools)
+      report(stderr);
+  }
+
+  void phase(const char *name, double s) {
+    std::lock_guard<std::mutex> lk(m);
+    PhaseStats &p = phases[name];
+    p.calls++;
+    p.seconds += s;
+  }
+
+  void count(const char *name, uint64_t n) {
+    std::lock_guard<std::mutex> lk(m);
+    counters[name] += n;
+  }
+
+  void round(const RoundStats &r) {
+    std::lock_guard<std::mutex> lk(m);
+    rounds.push_back(r);
+  }
+
+  // per-worker totals are summed by worker index over all pools
+  void pool(const std::vector<WorkerStats> &stats) {
+    if (stats.empty())
+      return;
+    std::lock_guard<std::mutex> lk(m);
+    pools++;
+    if (workers.size() < stats.size())
+      workers.resize(stats.size());
+    for (size_t i = 0; i < stats.size(); i++) {
+      workers[i].tasks += stats[i].tasks;
+      workers[i].steals += stats[i].steals;
+      workers[i].busySeconds += stats[i].busySeconds;
+      workers[i].idleSeconds += stats[i].idleSeconds;
+    }
+  }
+
+  void report(std::FILE *out) {
+    std::lock_guard<std::mutex> lk(m);
+    std::fprintf(out, "== instrumentation ==\n");
+    if (!phases.empty()) {
+      std::fprintf(out, "%-24s %8s %12s\n", "phase", "calls", "seconds");
+      for (const auto &p : phases)
+        std::fprintf(out, "%-24s %8llu %12.6f\n", p.first.c_str(),
+                     static_cast<unsigned long long>(p.second.calls),
+                     p.second.seconds);
+    }
+    if (!counters.empty()) {
+      std::fprintf(out, "%-24s %21s\n", "counter", "value");
+      for (const auto &c : counters)
+        std::fprintf(out, "%-24s %21llu\n", c.first.c_str(),
+                     static_cast<unsigned long long>(c.second));
+    }
+    if (!rounds.empty()) {
+      std::fprintf(out, "%-6s %14s %16s %14s %12s\n", "round", "nnz in",
+                   "products", "nnz out", "seconds");
+      for (size_t i = 0; i < rounds.size(); i++)
+        std::fprintf(out, "%-6zu %14zu %16zu %14zu %12.6f\n", i + 1,
+                     rounds[i].nnzIn, rounds[i].products, rounds[i].nnzOut,
+                     rounds[i].seconds);
+    }
+    if (!workers.empty()) {
+      std::fprintf(out, "pool workers, summed over %llu pools:\n",
+                   static_cast<unsigned long long>(pools));
+      std::fprintf(out, "%-6s %12s %10s %12s %12s %6s\n", "worker", "tasks",
+                   "steals", "busy s", "idle s", "util");
+      for (size_t i = 0; i < workers.size(); i++) {
+        const WorkerStats &w = workers[i];
+        double total = w.busySeconds + w.idleSeconds;
+        std::fprintf(out, "%-6zu %12llu %10llu %12.6f %12.6f %5.1f%%\n", i,
+                     static_cast<unsigned long long>(w.tasks),
+                     static_cast<unsigned long long>(w.steals), w.busySeconds,
+                     w.idleSeconds,
+                     total > 0 ? 100 * w.busySeconds / total : 0.0);
+      }
+    }
+    perf.report(out);
+  }
+};
+
+inline Registry &registry() {
+  static Registry r;
+  return r;
+}
+
+class ScopedPhase {
+private:
+  const char *name;
+  Clock::time_point start;
+
+public:
+  explicit ScopedPhase(const char *n) : name(n), start(Clock::now()) {}
+  ~ScopedPhase() { registry().phase(name, seconds(start)); }
+  ScopedPhase(const ScopedPhase &) = delete;
+  ScopedPhase &operator=(const ScopedPhase &) = delete;
+};
+
+} // namespace instrument
+
+#define MATRICES_CONCAT_(a, b) a##b
+#define MATRICES_CONCAT(a, b) MATRICES_CONCAT_(a, b)
+#define MATRICES_PHASE(name)                                                   \
+  instrument::ScopedPhase MATRICES_CONCAT(matrices_phase_, __LINE__)(name)
+#define MATRICES_COUNT(name, n) instrument::registry().count(name, n)
+#define MATRICES_INSTRUMENTED(...) __VA_ARGS__
+
+#else
+
+#define MATRICES_PHASE(name)                                                   \
+  do {                                                                         \
+  } while (0)
+#define MATRICES_COUNT(name, n)                                                \
+  do {                                                                         \
+  } while (0)
+#define MATRICES_INSTRUMENTED(...)
+
+#endif
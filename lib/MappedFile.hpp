@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file (POSIX). The mapping lives as
+// long as the object; an empty file maps to a null pointer and size 0.
+class MappedFile {
+private:
+  const char *ptr;
+  size_t length;
+
+  static std::runtime_error error(const std::string &what,
+                                  const std::string &path) {
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+  }
+
+public:
+  explicit MappedFile(const std::string &path) : ptr(nullptr), length(0) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw error("cannot open", path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw error("cannot stat", path);
+    }
+    length = static_cast<size_t>(st.st_size);
+    if (length) {
+      void *p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        throw error("cannot map", path);
+      }
+      ptr = static_cast<const char *>(p);
+    }
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (ptr)
+      ::munmap(const_cast<char *>(ptr), length);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return ptr; }
+  size_t size() const { return length; }
+
+  // access pattern hints, e.g. MADV_SEQUENTIAL before a single scan
+  void advise(int advice) const {
+    if (ptr)
+      ::madvise(const_cast<char *>(ptr), length, advice);
+  }
+};
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "MappedFile.hpp"
+#include "SparseMatrix.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+// Versioned binary snapshot of a CSR matrix, laid out so that a memory
+// mapping of the file can be used directly as a read-only CSRMatrix:
+//
+//   offset 0   SnapshotHeader (64 bytes)
+//   offset 64  row offsets     (rows + 1) x uint64
+//              column indices  nnz x uint64
+//              values          nnz x value type
+//
+// Every array starts 8-byte aligned. Integers are stored in host byte
+// order; the header records it so a file from another byte order is
+// rejected instead of misread.
+
+struct SnapshotHeader {
+  char magic[8];       // "SPMXSNAP"
+  uint32_t version;    // SnapshotHeader::currentVersion
+  uint32_t byteOrder;  // 0x01020304 as written by the host
+  uint32_t indexBytes; // width of offsets and column indices
+  uint32_t valueBytes; // sizeof(T)
+  uint32_t valueKind;  // SnapshotHeader::ValueKind
+  uint32_t reserved[3];
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t nnz;
+
+  static const uint32_t currentVersion = 1;
+  static const uint32_t hostOrder = 0x01020304;
+  enum ValueKind { Signed = 0, Unsigned = 1, Floating = 2 };
+
+  template <typename T> static uint32_t kindOf() {
+    return std::is_floating_point<T>::value
+               ? Floating
+               : (std::numeric_limits<T>::is_signed ? Signed : Unsigned);
+  }
+};
+
+static_assert(sizeof(SnapshotHeader) == 64, "snapshot header must be 64 bytes");
+
+namespace snapshot {
+
+inline void write(std::FILE *f, const void *data, size_t bytes,
+                  const std::string &path) {
+  if (bytes && std::fwrite(data, 1, bytes, f) != bytes) {
+    std::fclose(f);
+    throw std::runtime_error("cannot write " + path);
+  }
+}
+
+} // namespace snapshot
+
+template <typename T>
+void saveSnapshot(const CSRMatrix<T> &m, const std::string &path) {
+  static_assert(sizeof(size_t) == 8, "snapshots store 64-bit indices");
+  static_assert(std::is_arithmetic<T>::value, "snapshots hold plain numbers");
+
+  SnapshotHeader h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, "SPMXSNAP", 8);
+  h.version = SnapshotHeader::currentVersion;
+  h.byteOrder = SnapshotHeader::hostOrder;
+  h.indexBytes = sizeof(size_t);
+  h.valueBytes = sizeof(T);
+  h.valueKind = SnapshotHeader::kindOf<T>();
+  h.rows = m.getNumRows();
+  h.cols = m.getNumCols();
+  h.nnz = m.nnz();
+
+  std::FILE *f = std::fopen(path.c_str(), "wb");
+  if (!f)
+    throw std::runtime_error("cannot create " + path);
+  snapshot::write(f, &h, sizeof(h), path);
+  snapshot::write(f, m.getRowPtr(), (h.rows + 1) * sizeof(size_t), path);
+  snapshot::write(f, m.getColIdx(), h.nnz * sizeof(size_t), path);
+  snapshot::write(f, m.getValues(), h.nnz * sizeof(T), path);
+  // values of narrow types may leave the file short of a multiple of 8
+  static const char pad[8] = {0};
+  snapshot::write(f, pad, (8 - h.nnz * sizeof(T) % 8) % 8, path);
+  if (std::fclose(f) != 0)
+    throw std::runtime_error("cannot write " + path);
+}
+
+template <typename T>
+void saveSnapshot(const SparseMatrix<T> &m, const std::string &path) {
+  saveSnapshot(m.toCSR(), path);
+}
+
+// Maps a snapshot and returns a borrowed CSRMatrix over the mapping; the
+// mapping is released when the last copy of the matrix goes away. By
+// default only the header and the row offsets are checked, so loading
+// costs O(rows) and the index and value pages are faulted in by the first
+// kernel that reads them. The kernels use column indices directly as
+// accumulator indices, so a file that is not trusted should be loaded
+// with checkColumns, which also checks every row ascends within [0, cols)
+// at the cost of reading all indices once.
+template <typename T>
+CSRMatrix<T> loadSnapshot(const std::string &path, bool checkColumns = false) {
+  std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(path);
+  const char *base = file->data();
+  size_t size = file->size();
+
+  SnapshotHeader h;
+  if (size < sizeof(h))
+    throw std::runtime_error(path + " is not a matrix snapshot");
+  std::memcpy(&h, base, sizeof(h));
+  if (std::memcmp(h.magic, "SPMXSNAP", 8) != 0)
+    throw std::runtime_error(path + " is not a matrix snapshot");
+  if (h.version != SnapshotHeader::currentVersion)
+    throw std::runtime_error(path + ": unsupported snapshot version " +
+                             std::to_string(h.version));
+  if (h.byteOrder != SnapshotHeader::hostOrder)
+    throw std::runtime_error(path + ": snapshot has foreign byte order");
+  if (h.indexBytes != sizeof(size_t) || h.valueBytes != sizeof(T) ||
+      h.valueKind != SnapshotHeader::kindOf<T>())
+    throw std::runtime_error(path + ": snapshot value type does not match");
+
+  // bounded by the file size before any product is formed, so a corrupt
+  // count cannot wrap the sizes below
+  size_t body = size - sizeof(h);
+  if (h.rows >= body / sizeof(size_t) ||
+      h.nnz > body / (sizeof(size_t) + sizeof(T)))
+    throw std::runtime_error(path + ": snapshot is truncated");
+  // nnz <= rows * cols without forming the product
+  if (h.nnz != 0 && (h.cols == 0 || (h.nnz - 1) / h.cols >= h.rows))
+    throw std::runtime_error(path + ": snapshot has more entries than its "
+                             "shape holds");
+  size_t ptrBytes = (h.rows + 1) * sizeof(size_t);
+  size_t idxBytes = h.nnz * sizeof(size_t);
+  size_t valBytes = h.nnz * sizeof(T);
+  if (body < ptrBytes + idxBytes + valBytes)
+    throw std::runtime_error(path + ": snapshot is truncated");
+
+  const size_t *ptr = reinterpret_cast<const size_t *>(base + sizeof(h));
+  const size_t *idx =
+      reinterpret_cast<const size_t *>(base + sizeof(h) + ptrBytes);
+  const T *val =
+      reinterpret_cast<const T *>(base + sizeof(h) + ptrBytes + idxBytes);
+
+  if (ptr[0] != 0 || ptr[h.rows] != h.nnz)
+    throw std::runtime_error(path + ": snapshot row offsets are corrupt");
+  for (size_t i = 0; i < h.rows; i++) {
+    if (ptr[i] > ptr[i + 1])
+      throw std::runtime_error(path + ": snapshot row offsets are corrupt");
+  }
+  if (checkColumns) {
+    for (size_t i = 0; i < h.rows; i++) {
+      for (size_t q = ptr[i]; q < ptr[i + 1]; q++) {
+        if (idx[q] >= h.cols || (q > ptr[i] && idx[q - 1] >= idx[q]))
+          throw std::runtime_error(path + ": snapshot column indices of row " +
+                                   std::to_string(i) + " are corrupt");
+      }
+    }
+  }
+
+  // start reading ahead while the caller sets up
+  file->advise(MADV_WILLNEED);
+  return CSRMatrix<T>(h.rows, h.cols, ptr, idx, val,
+                      std::shared_ptr<const void>(file, file.get()));
+}
+
+// Reports whether path starts with the snapshot magic.
+inline bool isSnapshot(const std::string &path) {
+  std::FILE *f = std::fopen(path.c_str(), "rb");
+  if (!f)
+    return false;
+  char magic[8];
+  bool ok = std::fread(magic, 1, 8, f) == 8 &&
+            std::memcmp(magic, "SPMXSNAP", 8) == 0;
+  std::fclose(f);
+  return ok;
+}
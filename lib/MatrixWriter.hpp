@@ -0,0 +1,205 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "MatrixSnapshot.hpp"
+#include "RowBlockFile.hpp"
+#include "SpGEMM.hpp"
+#include "SparseMatrix.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Sparse result writers: only nonzeros are emitted, as DIMACS arc lines
+// ("a <from> <to> <weight>", 1-based, after a "p sp <nodes> <arcs>"
+// header) or as a binary snapshot (MatrixSnapshot.hpp). Text is formatted
+// on the pool, one block of rows per piece into its own buffer, and the
+// buffers are written in row order with large sequential writes. The
+// text reads back with loadDimacs.
+
+namespace dimacsout {
+
+// entries per formatting task; about a megabyte of text
+const size_t blockEntries = 1 << 16;
+
+inline char *formatUnsigned(char *p, size_t v) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = char('0' + v % 10);
+    v /= 10;
+  } while (v);
+  while (n)
+    *p++ = digits[--n];
+  return p;
+}
+
+// Integral weights, the common case in DIMACS files, skip printf; other
+// values use %.17g so they read back exactly.
+template <typename T> inline char *formatValue(char *p, T v) {
+  double d = static_cast<double>(v);
+  if (d == std::floor(d) && std::fabs(d) < 9007199254740992.0) {
+    if (d < 0) {
+      *p++ = '-';
+      d = -d;
+    }
+    return formatUnsigned(p, static_cast<size_t>(d));
+  }
+  return p + std::snprintf(p, 32, "%.17g", d);
+}
+
+// Appends the arc lines of rows [begin, end) of m, numbered from
+// rowOffset.
+template <typename T>
+void formatRows(const CSRMatrix<T> &m, size_t rowOffset, size_t begin,
+                size_t end, std::string &out) {
+  // "a " + 2 x 20 digits + 2 spaces + 32 value chars + newline
+  const size_t maxLine = 80;
+  out.resize((m.rowBegin(end) - m.rowBegin(begin)) * maxLine);
+  char *base = &out[0], *p = base;
+  for (size_t i = begin; i < end; i++) {
+    for (size_t q = m.rowBegin(i); q < m.rowEnd(i); q++) {
+      *p++ = 'a';
+      *p++ = ' ';
+      p = formatUnsigned(p, rowOffset + i + 1);
+      *p++ = ' ';
+      p = formatUnsigned(p, m.col(q) + 1);
+      *p++ = ' ';
+      p = formatValue(p, m.value(q));
+      *p++ = '\n';
+    }
+  }
+  out.resize(p - base);
+}
+
+class TextFile {
+private:
+  std::FILE *file;
+  std::string path;
+  size_t written;
+
+public:
+  explicit TextFile(const std::string &p) : path(p), written(0) {
+    file = std::fopen(path.c_str(), "wb");
+    if (!file)
+      throw std::runtime_error("cannot create " + path);
+  }
+  ~TextFile() {
+    if (file)
+      std::fclose(file);
+  }
+  TextFile(const TextFile &) = delete;
+  TextFile &operator=(const TextFile &) = delete;
+
+  void write(const std::string &s) {
+    if (!s.empty() && std::fwrite(s.data(), 1, s.size(), file) != s.size())
+      throw std::runtime_error("cannot write " + path);
+    written += s.size();
+  }
+
+  size_t close() {
+    int rc = std::fclose(file);
+    file = nullptr;
+    if (rc != 0)
+      throw std::runtime_error("cannot write " + path);
+    return written;
+  }
+};
+
+// Formats all rows of m in batches of blocks and appends them to out. A
+// batch is formatted by one parallel_for, which waits for nothing but its
+// own pieces, and is written only once all of them are done: a failed
+// write or allocation never leaves pieces running on freed buffers.
+template <typename T>
+void writeRows(const CSRMatrix<T> &m, size_t rowOffset, TextFile &out,
+               thread_pool *pool) {
+  // block boundaries at whole rows, about blockEntries entries apart
+  std::vector<size_t> bounds(1, 0);
+  for (size_t i = 0; i < m.getNumRows(); i++) {
+    if (m.rowEnd(i) - m.rowBegin(bounds.back()) >= blockEntries)
+      bounds.push_back(i + 1);
+  }
+  if (bounds.back() != m.getNumRows())
+    bounds.push_back(m.getNumRows());
+
+  size_t blocks = bounds.size() - 1;
+  size_t batch = 2 * workerSlots(pool);
+  std::vector<std::string> text(batch);
+
+  for (size_t first = 0; first < blocks; first += batch) {
+    size_t count = std::min(batch, blocks - first);
+    // a piece that throws would end parallel_for with others still
+    // running; the first failure is kept and rethrown after the join
+    std::exception_ptr failed;
+    std::mutex failedMutex;
+    forEachRange(pool, count, [&](size_t begin, size_t end) {
+      try {
+        for (size_t b = begin; b < end; b++)
+          formatRows(m, rowOffset, bounds[first + b], bounds[first + b + 1],
+                     text[b]);
+      } catch (...) {
+        std::lock_guard<std::mutex> lk(failedMutex);
+        if (!failed)
+          failed = std::current_exception();
+      }
+    });
+    if (failed)
+      std::rethrow_exception(failed);
+    for (size_t b = 0; b < count; b++)
+      out.write(text[b]);
+  }
+}
+
+inline std::string header(size_t nodes, size_t arcs) {
+  return "p sp " + std::to_string(nodes) + " " + std::to_string(arcs) + "\n";
+}
+
+} // namespace dimacsout
+
+// Writes m as a DIMACS file; returns the bytes written.
+template <typename T>
+size_t writeDimacs(const CSRMatrix<T> &m, const std::string &path,
+                   thread_pool *pool = nullptr) {
+  dimacsout::TextFile out(path);
+  out.write(dimacsout::header(m.getNumRows(), m.nnz()));
+  dimacsout::writeRows(m, 0, out, pool);
+  return out.close();
+}
+
+template <typename T>
+size_t writeDimacs(const SparseMatrix<T> &m, const std::string &path,
+                   thread_pool *pool = nullptr) {
+  return writeDimacs(m.toCSR(), path, pool);
+}
+
+// Streams a row block file (e.g. an out-of-core result) to DIMACS text,
+// one block in memory at a time.
+template <typename T>
+size_t writeDimacs(RowBlockReader<T> &in, const std::string &path,
+                   thread_pool *pool = nullptr) {
+  dimacsout::TextFile out(path);
+  out.write(dimacsout::header(in.getNumRows(), in.countNonZeros()));
+  size_t first;
+  CSRMatrix<T> block;
+  while (in.next(first, block))
+    dimacsout::writeRows(block, first, out, pool);
+  return out.close();
+}
+
+// Binary form: a snapshot that loadSnapshot maps back without parsing.
+template <typename T>
+size_t writeBinary(const CSRMatrix<T> &m, const std::string &path) {
+  saveSnapshot(m, path);
+  return sizeof(SnapshotHeader) + (m.getNumRows() + 1) * sizeof(size_t) +
+         m.nnz() * sizeof(size_t) + (m.nnz() * sizeof(T) + 7) / 8 * 8;
+}
+
+template <typename T>
+size_t writeBinary(const SparseMatrix<T> &m, const std::string &path) {
+  return writeBinary(m.toCSR(), path);
+}
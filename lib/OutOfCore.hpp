@@ -0,0 +1,170 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "Instrument.hpp"
+#include "RowBlockFile.hpp"
+#include "SemiNaive.hpp"
+#include "SpGEMM.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Out-of-core closure: the result is produced one row block at a time and
+// spilled to a RowBlockFile, so only the operand, the per-worker scratch
+// and one block are ever in memory, whatever the size of the result.
+//
+// The memory budget covers what the engine allocates and can account
+// for: the operand, the scratch, the row table, the write buffer and the
+// buffered rows by capacity. It is not a bound on the process RSS. The
+// allocator's per-thread arenas and fragmentation, thread stacks, code
+// pages and whatever the caller keeps (such as the input it converted
+// the operand from) come on top, and are not known to the engine. On
+// test10000 they added about 1.5 MB to a 4 MB budget. The overhead grows
+// with the thread count, not with the budget.
+//
+// Rows come from semi-naive relaxation against A (see SemiNaive.hpp),
+// which needs nothing but A to finish a row. Squaring would have to read
+// the whole previous X back from disk once per output block, every round.
+//
+// Workers claim rows in small chunks from a shared counter, so a block is
+// always a contiguous run of rows. Before computing a chunk a worker
+// reserves room for a worst-case row (n entries) per row and afterwards
+// gives back what the rows did not use, so the buffered rows never exceed
+// the block budget; chunks shrink as the budget fills, and a block ends
+// once the rest of the budget cannot hold one more worst-case row.
+
+struct OutOfCoreStats {
+  size_t blocks;
+  size_t nnz;
+  size_t bytesWritten;
+  size_t fixedBytes;  // operand, scratch, row table and write buffer
+  size_t blockBudget; // what was left for buffered result rows
+  size_t peakBlockBytes;
+  double seconds;
+
+  OutOfCoreStats()
+      : blocks(0), nnz(0), bytesWritten(0), fixedBytes(0), blockBudget(0),
+        peakBlockBytes(0), seconds(0) {}
+};
+
+// Writes the closure of a over S to path, keeping the engine's accounted
+// memory (see above) within memoryBudget bytes. a may be any storage semiNaiveRow accepts; a
+// compact one leaves more of the budget for row blocks. Throws
+// std::runtime_error when the budget cannot even hold the operand and the
+// scratch space.
+template <typename S, typename M>
+OutOfCoreStats outOfCoreClosure(const M &a, const std::string &path,
+                                size_t memoryBudget,
+                                thread_pool *pool = nullptr) {
+  typedef typename S::value_type T;
+  static_assert(S::idempotent, "out-of-core closure needs an idempotent S");
+  assert(a.getNumRows() == a.getNumCols());
+  MATRICES_PHASE("closure.outofcore");
+  auto start = std::chrono::high_resolution_clock::now();
+  size_t n = a.getNumRows();
+  size_t slots = workerSlots(pool);
+  const size_t writeBuffer = 1 << 20;
+  const size_t chunk = 16;
+
+  OutOfCoreStats stats;
+  stats.fixedBytes = a.bytes() + slots * SemiNaiveScratch<T>::footprint(n) +
+                     n * (sizeof(std::vector<uint32_t>) +
+                          sizeof(std::vector<T>)) +
+                     writeBuffer;
+  // buffered rows keep 32-bit columns and exactly as much capacity as
+  // they have entries
+  const size_t rowMax = std::max<size_t>(n, 1) * (sizeof(uint32_t) + sizeof(T));
+  // at least room for one full row at a time
+  size_t minBlock = rowMax;
+  if (memoryBudget < stats.fixedBytes + minBlock)
+    throw std::runtime_error(
+        "memory budget too small for the out-of-core closure: need at least " +
+        std::to_string((stats.fixedBytes + minBlock + (1 << 20) - 1) >> 20) +
+        " MB");
+  stats.blockBudget = memoryBudget - stats.fixedBytes;
+
+  RowBlockWriter<T> writer(path, n, n, writeBuffer);
+  std::vector<std::vector<uint32_t>> rowCols(n);
+  std::vector<std::vector<T>> rowVals(n);
+  std::vector<SemiNaiveScratch<T>> scratch(slots);
+
+  size_t row = 0;
+  while (row < n) {
+    std::atomic<size_t> claim(row);
+    std::atomic<size_t> used(0); // buffered rows plus reservations
+
+    // reserves worst-case room for up to chunk rows; returns how many
+    auto reserve = [&]() -> size_t {
+      size_t u = used.load();
+      for (;;) {
+        size_t rows = std::min(chunk, (stats.blockBudget - u) / rowMax);
+        if (rows == 0)
+          return 0;
+        if (used.compare_exchange_weak(u, u + rows * rowMax))
+          return rows;
+      }
+    };
+
+    auto work = [&](size_t, size_t) {
+      SemiNaiveScratch<T> &s = scratch[workerSlot(pool)];
+      s.resize(n);
+      for (;;) {
+        size_t rows = reserve();
+        if (rows == 0)
+          break;
+        size_t begin = claim.fetch_add(rows);
+        if (begin >= n) {
+          used -= rows * rowMax;
+          break;
+        }
+        size_t end = std::min(begin + rows, n);
+        size_t bytes = 0;
+        for (size_t i = begin; i < end; i++) {
+          semiNaiveRow<S>(a, i, s);
+          auto &c = rowCols[i];
+          auto &v = rowVals[i];
+          c.reserve(s.dist.nnz());
+          v.reserve(s.dist.nnz());
+          s.dist.flush([&c, &v](size_t col, const T &value) {
+            if (value != T(0)) {
+              c.push_back(static_cast<uint32_t>(col));
+              v.push_back(value);
+            }
+          });
+          bytes += c.capacity() * sizeof(uint32_t) + v.capacity() * sizeof(T);
+        }
+        // keep what the rows use, give back the rest of the reservation
+        used -= rows * rowMax - bytes;
+      }
+    };
+    if (pool)
+      pool->parallel_for(0, slots, 1, work);
+    else
+      work(0, 1);
+
+    MATRICES_PHASE("closure.outofcore.write");
+    // every claimed chunk was finished, so [row, end) is complete, and
+    // used is back to the buffered rows alone
+    size_t end = std::min(claim.load(), n);
+    for (size_t i = row; i < end; i++)
+      stats.nnz += rowCols[i].size();
+    stats.peakBlockBytes = std::max(stats.peakBlockBytes, used.load());
+    assert(used.load() <= stats.blockBudget);
+    writer.writeBlock(row, end - row, rowCols, rowVals);
+    stats.blocks++;
+    row = end;
+  }
+  writer.close();
+
+  stats.bytesWritten = writer.bytesWritten();
+  stats.seconds = std::chrono::duration_cast<std::chrono::duration<double>>(
+                      std::chrono::high_resolution_clock::now() - start)
+                      .count();
+  return stats;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <vector>
+
+// Sorts v with comp on the pool: every worker sorts one contiguous run,
+// then pairs of neighbouring runs are merged through a buffer, all merges
+// of a round in parallel, until a single run is left. Not stable. Without
+// a pool this is std::sort.
+template <typename V, typename Compare>
+void parallelSort(std::vector<V> &v, Compare comp,
+                  thread_pool *pool = nullptr) {
+  size_t n = v.size();
+  size_t runs = pool ? std::min(pool->size() + 1, n / 4096 + 1) : 1;
+  if (runs <= 1) {
+    std::sort(v.begin(), v.end(), comp);
+    return;
+  }
+
+  std::vector<size_t> bounds(runs + 1);
+  for (size_t r = 0; r <= runs; r++)
+    bounds[r] = n * r / runs;
+
+  pool->parallel_for(0, runs, 1, [&](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; r++)
+      std::sort(v.begin() + bounds[r], v.begin() + bounds[r + 1], comp);
+  });
+
+  std::vector<V> buffer(n);
+  std::vector<V> *src = &v, *dst = &buffer;
+  while (bounds.size() > 2) {
+    size_t pairs = (bounds.size() - 1) / 2;
+    pool->parallel_for(0, pairs + 1, 1, [&](size_t begin, size_t end) {
+      for (size_t p = begin; p < end; p++) {
+        size_t lo = bounds[2 * p];
+        if (2 * p + 2 < bounds.size()) {
+          size_t mid = bounds[2 * p + 1], hi = bounds[2 * p + 2];
+          std::merge(src->begin() + lo, src->begin() + mid,
+                     src->begin() + mid, src->begin() + hi,
+                     dst->begin() + lo, comp);
+        } else if (2 * p + 1 < bounds.size()) {
+          // odd run out, carried over unchanged
+          std::copy(src->begin() + lo, src->begin() + bounds[2 * p + 1],
+                    dst->begin() + lo);
+        }
+      }
+    });
+    std::vector<size_t> next;
+    for (size_t r = 0; r < bounds.size(); r += 2)
+      next.push_back(bounds[r]);
+    if (next.back() != n)
+      next.push_back(n);
+    bounds.swap(next);
+    std::swap(src, dst);
+  }
+  if (src != &v)
+    v.swap(*src);
+}
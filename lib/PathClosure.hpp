@@ -0,0 +1,154 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "Dijkstra.hpp"
+#include "Instrument.hpp"
+#include "SemiNaive.hpp"
+#include "SpGEMM.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Closure with routes: next to every distance entry (i, j) it keeps the
+// last vertex before j on a best path from i to j (i itself for a path of
+// one arc), as a 32-bit index in an array parallel to the CSR values.
+// Row i alone then holds the search tree of source i, and path(i, j)
+// walks it back from j.
+//
+// The predecessors are recorded by the per-source searches themselves,
+// through their improvement hook, so tracking them costs one 4-byte store
+// per improvement and 4 bytes per result entry, not a second pass. Rows
+// come from dijkstraRow when label setting applies, from semiNaiveRow
+// otherwise, and the distances equal squaringClosure<S>().
+//
+// Predecessors are taken from the tree of one source rather than chaining
+// next hops through the rows of other sources: ties (zero-weight cycles
+// in min-plus, equal bottlenecks in max-min) can make such chains loop.
+
+template <typename T> struct PathClosure {
+  CSRMatrix<T> dist;
+  std::vector<uint32_t> pred; // parallel to dist's values
+
+  size_t nnz() const { return dist.nnz(); }
+
+  // position of (i, j) in dist, or nnz() when there is no path
+  size_t find(size_t i, size_t j) const {
+    const size_t *begin = dist.getColIdx() + dist.rowBegin(i);
+    const size_t *end = dist.getColIdx() + dist.rowEnd(i);
+    const size_t *it = std::lower_bound(begin, end, j);
+    return it != end && *it == j ? size_t(it - dist.getColIdx()) : nnz();
+  }
+
+  // T(0) when there is no path, like the sparse matrices
+  T get(size_t i, size_t j) const {
+    size_t p = find(i, j);
+    return p == nnz() ? T(0) : dist.value(p);
+  }
+
+  // last vertex before j on a best path from i; i has a path to j
+  size_t predecessor(size_t i, size_t j) const {
+    size_t p = find(i, j);
+    assert(p != nnz());
+    return pred[p];
+  }
+
+  // Vertices of a best path from i to j, both ends included (a cycle when
+  // i == j), or empty when there is none. A path whose prefix sums to T(0)
+  // cannot be followed, since the sparse form drops that entry, and throws
+  // std::runtime_error.
+  std::vector<size_t> path(size_t i, size_t j) const {
+    std::vector<size_t> p;
+    if (find(i, j) == nnz())
+      return p;
+    p.push_back(j);
+    size_t v = j;
+    do {
+      size_t at = find(i, v);
+      if (at == nnz() || p.size() > dist.getNumRows())
+        throw std::runtime_error("PathClosure: no path back from " +
+                                 std::to_string(j) + " to " +
+                                 std::to_string(i));
+      v = pred[at];
+      p.push_back(v);
+    } while (v != i);
+    std::reverse(p.begin(), p.end());
+    return p;
+  }
+
+  size_t bytes() const { return dist.bytes() + pred.size() * sizeof(uint32_t); }
+};
+
+template <typename S, typename M>
+PathClosure<typename S::value_type> pathClosure(const M &a,
+                                                thread_pool *pool = nullptr) {
+  typedef typename S::value_type T;
+  static_assert(S::idempotent, "path closure needs an idempotent S");
+  assert(a.getNumRows() == a.getNumCols());
+  size_t n = a.getNumRows();
+  if (n > size_t(std::numeric_limits<uint32_t>::max()))
+    throw std::range_error(std::to_string(n) +
+                           " vertices do not fit 32-bit predecessors");
+  MATRICES_PHASE("closure.paths");
+  bool labelSetting = labelSettingApplies<S>(a);
+
+  struct Scratch {
+    DijkstraScratch<T> dijkstra;
+    SemiNaiveScratch<T> semiNaive;
+    std::vector<uint32_t> pred;
+  };
+  std::vector<std::vector<size_t>> rowCols(n);
+  std::vector<std::vector<T>> rowVals(n);
+  std::vector<std::vector<uint32_t>> rowPreds(n);
+  std::vector<Scratch> scratch(workerSlots(pool));
+
+  forEachRange(pool, n, [&](size_t begin, size_t end) {
+    Scratch &s = scratch[workerSlot(pool)];
+    s.pred.resize(n);
+    std::vector<uint32_t> &pred = s.pred;
+    for (size_t i = begin; i < end; i++) {
+      auto improved = [&pred, i](size_t j, size_t k) {
+        pred[j] = uint32_t(k == fromSource ? i : k);
+      };
+      SparseAccumulator<T> *dist;
+      if (labelSetting) {
+        s.dijkstra.resize(n);
+        dijkstraRow<S>(a, i, s.dijkstra, improved);
+        dist = &s.dijkstra.dist;
+      } else {
+        s.semiNaive.resize(n);
+        semiNaiveRow<S>(a, i, s.semiNaive, improved);
+        dist = &s.semiNaive.dist;
+      }
+      auto &c = rowCols[i];
+      auto &v = rowVals[i];
+      auto &h = rowPreds[i];
+      c.reserve(dist->nnz());
+      v.reserve(dist->nnz());
+      h.reserve(dist->nnz());
+      dist->flush([&](size_t col, const T &value) {
+        if (value != T(0)) {
+          c.push_back(col);
+          v.push_back(value);
+          h.push_back(pred[col]);
+        }
+      });
+    }
+  });
+
+  PathClosure<T> r;
+  r.dist = concatRows(n, rowCols, rowVals, pool);
+  r.pred.resize(r.dist.nnz());
+  forEachRange(pool, n, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      std::copy(rowPreds[i].begin(), rowPreds[i].end(),
+                r.pred.begin() + r.dist.rowBegin(i));
+      std::vector<uint32_t>().swap(rowPreds[i]);
+    }
+  });
+  return r;
+}
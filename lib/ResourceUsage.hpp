@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdio>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// Resident set size of the calling process, in bytes (Linux).
+
+// Highest RSS reached so far.
+inline size_t peakRSSBytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return static_cast<size_t>(usage.ru_maxrss) * 1024; // reported in KiB
+}
+
+// RSS right now, from /proc/self/statm; 0 where that is unavailable.
+inline size_t currentRSSBytes() {
+  std::FILE *f = std::fopen("/proc/self/statm", "r");
+  if (!f)
+    return 0;
+  unsigned long size = 0, resident = 0;
+  int read = std::fscanf(f, "%lu %lu", &size, &resident);
+  std::fclose(f);
+  if (read != 2)
+    return 0;
+  return static_cast<size_t>(resident) * sysconf(_SC_PAGESIZE);
+}
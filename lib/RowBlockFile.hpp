@@ -0,0 +1,248 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Sequential file of CSR row blocks, for results that are produced and
+// consumed one slice of rows at a time and need not fit in memory:
+//
+//   file header   "SPMXROWS", uint32 version, uint32 sizeof(T),
+//                 uint64 rows, uint64 cols
+//   per block     uint64 firstRow, uint64 rowCount, uint64 nnz,
+//                 rowCount x uint32 row lengths, nnz x uint32 columns,
+//                 nnz x T values, zero padding to 8 bytes
+//
+// Blocks cover the rows in ascending order without gaps. Column indices
+// are 32 bits, so a block costs 4 + sizeof(T) bytes per entry on disk.
+
+namespace rowblock {
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t valueBytes;
+  uint64_t rows;
+  uint64_t cols;
+};
+
+struct BlockHeader {
+  uint64_t firstRow;
+  uint64_t rowCount;
+  uint64_t nnz;
+};
+
+static const uint32_t currentVersion = 1;
+
+} // namespace rowblock
+
+template <typename T> class RowBlockWriter {
+private:
+  std::FILE *file;
+  std::string path;
+  size_t rows;
+  size_t cols;
+  size_t nextRow;
+  size_t written;
+  std::vector<char> buffer;
+
+  void write(const void *data, size_t bytes) {
+    if (bytes && std::fwrite(data, 1, bytes, file) != bytes)
+      throw std::runtime_error("cannot write " + path);
+    written += bytes;
+  }
+
+public:
+  // bufferBytes is the stdio buffer, part of the writer's memory footprint
+  RowBlockWriter(const std::string &p, size_t r, size_t c,
+                 size_t bufferBytes = 1 << 20)
+      : file(nullptr), path(p), rows(r), cols(c), nextRow(0), written(0),
+        buffer(bufferBytes) {
+    if (cols > UINT32_MAX)
+      throw std::runtime_error("row block files hold 32-bit columns");
+    file = std::fopen(path.c_str(), "wb");
+    if (!file)
+      throw std::runtime_error("cannot create " + path);
+    std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+
+    rowblock::FileHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, "SPMXROWS", 8);
+    h.version = rowblock::currentVersion;
+    h.valueBytes = sizeof(T);
+    h.rows = rows;
+    h.cols = cols;
+    write(&h, sizeof(h));
+  }
+
+  ~RowBlockWriter() {
+    if (file)
+      std::fclose(file);
+  }
+
+  RowBlockWriter(const RowBlockWriter &) = delete;
+  RowBlockWriter &operator=(const RowBlockWriter &) = delete;
+
+  size_t bytesWritten() const { return written; }
+
+  // Appends rows [firstRow, firstRow + count) taken from rowCols/rowVals
+  // at the same offsets, releasing each row's storage once written.
+  void writeBlock(size_t firstRow, size_t count,
+                  std::vector<std::vector<uint32_t>> &rowCols,
+                  std::vector<std::vector<T>> &rowVals) {
+    if (firstRow != nextRow || firstRow + count > rows)
+      throw std::logic_error("row blocks must be written in order");
+    rowblock::BlockHeader h = {firstRow, count, 0};
+    for (size_t i = firstRow; i < firstRow + count; i++)
+      h.nnz += rowCols[i].size();
+    write(&h, sizeof(h));
+    for (size_t i = firstRow; i < firstRow + count; i++) {
+      uint32_t len = static_cast<uint32_t>(rowCols[i].size());
+      write(&len, sizeof(len));
+    }
+    for (size_t i = firstRow; i < firstRow + count; i++) {
+      write(rowCols[i].data(), rowCols[i].size() * sizeof(uint32_t));
+      std::vector<uint32_t>().swap(rowCols[i]);
+    }
+    for (size_t i = firstRow; i < firstRow + count; i++) {
+      write(rowVals[i].data(), rowVals[i].size() * sizeof(T));
+      std::vector<T>().swap(rowVals[i]);
+    }
+    static const char pad[8] = {0};
+    write(pad, (8 - written % 8) % 8);
+    nextRow += count;
+  }
+
+  void close() {
+    if (nextRow != rows)
+      throw std::logic_error("row block file closed before its last row");
+    int rc = std::fclose(file);
+    file = nullptr;
+    if (rc != 0)
+      throw std::runtime_error("cannot write " + path);
+  }
+};
+
+template <typename T> class RowBlockReader {
+private:
+  std::FILE *file;
+  std::string path;
+  size_t rows;
+  size_t cols;
+  size_t nextRow;
+  size_t offset;
+
+  void read(void *data, size_t bytes) {
+    if (bytes && std::fread(data, 1, bytes, file) != bytes)
+      throw std::runtime_error(path + ": row block file is truncated");
+    offset += bytes;
+  }
+
+public:
+  explicit RowBlockReader(const std::string &p)
+      : file(nullptr), path(p), rows(0), cols(0), nextRow(0), offset(0) {
+    file = std::fopen(path.c_str(), "rb");
+    if (!file)
+      throw std::runtime_error("cannot open " + path);
+    rowblock::FileHeader h;
+    read(&h, sizeof(h));
+    if (std::memcmp(h.magic, "SPMXROWS", 8) != 0 ||
+        h.version != rowblock::currentVersion)
+      throw std::runtime_error(path + " is not a row block file");
+    if (h.valueBytes != sizeof(T))
+      throw std::runtime_error(path + ": row block value type does not match");
+    rows = h.rows;
+    cols = h.cols;
+  }
+
+  ~RowBlockReader() {
+    if (file)
+      std::fclose(file);
+  }
+
+  RowBlockReader(const RowBlockReader &) = delete;
+  RowBlockReader &operator=(const RowBlockReader &) = delete;
+
+  size_t getNumRows() const { return rows; }
+  size_t getNumCols() const { return cols; }
+
+  // Total entries, from the block headers alone; must be called before
+  // next().
+  size_t countNonZeros() {
+    if (nextRow != 0)
+      throw std::logic_error("countNonZeros after next");
+    size_t start = offset, total = 0;
+    for (size_t row = 0; row < rows;) {
+      rowblock::BlockHeader h;
+      read(&h, sizeof(h));
+      if (h.firstRow != row || h.rowCount == 0)
+        throw std::runtime_error(path + ": row blocks are out of order");
+      size_t payload = (h.rowCount + h.nnz) * sizeof(uint32_t) +
+                       h.nnz * sizeof(T);
+      offset += payload + (8 - (offset + payload) % 8) % 8;
+      if (std::fseek(file, static_cast<long>(offset), SEEK_SET) != 0)
+        throw std::runtime_error(path + ": row block file is truncated");
+      total += h.nnz;
+      row += h.rowCount;
+    }
+    offset = start;
+    std::fseek(file, static_cast<long>(offset), SEEK_SET);
+    return total;
+  }
+
+  // Reads the next block into block (rows numbered from 0) and its first
+  // global row into firstRow; false after the last block.
+  bool next(size_t &firstRow, CSRMatrix<T> &block) {
+    if (nextRow == rows)
+      return false;
+    rowblock::BlockHeader h;
+    read(&h, sizeof(h));
+    if (h.firstRow != nextRow || h.firstRow + h.rowCount > rows)
+      throw std::runtime_error(path + ": row blocks are out of order");
+
+    std::vector<uint32_t> lengths(h.rowCount), idx32(h.nnz);
+    read(lengths.data(), lengths.size() * sizeof(uint32_t));
+    read(idx32.data(), idx32.size() * sizeof(uint32_t));
+    std::vector<T> val(h.nnz);
+    read(val.data(), val.size() * sizeof(T));
+    char pad[8];
+    read(pad, (8 - offset % 8) % 8);
+
+    std::vector<size_t> ptr(h.rowCount + 1, 0);
+    for (size_t i = 0; i < h.rowCount; i++)
+      ptr[i + 1] = ptr[i] + lengths[i];
+    if (ptr[h.rowCount] != h.nnz)
+      throw std::runtime_error(path + ": row block lengths are corrupt");
+    std::vector<size_t> idx(idx32.begin(), idx32.end());
+
+    firstRow = h.firstRow;
+    nextRow += h.rowCount;
+    block = CSRMatrix<T>(h.rowCount, cols, std::move(ptr), std::move(idx),
+                         std::move(val));
+    return true;
+  }
+
+  // Gathers every block into one matrix, for results that do fit; must be
+  // called before next().
+  CSRMatrix<T> readAll() {
+    if (nextRow != 0)
+      throw std::logic_error("readAll after next");
+    std::vector<size_t> ptr(1, 0), idx;
+    std::vector<T> val;
+    size_t first;
+    CSRMatrix<T> block;
+    while (next(first, block)) {
+      for (size_t i = 0; i < block.getNumRows(); i++)
+        ptr.push_back(ptr.back() + block.rowSize(i));
+      idx.insert(idx.end(), block.getColIdx(), block.getColIdx() + block.nnz());
+      val.insert(val.end(), block.getValues(), block.getValues() + block.nnz());
+    }
+    ptr.resize(rows + 1, ptr.back());
+    return CSRMatrix<T>(rows, cols, std::move(ptr), std::move(idx),
+                        std::move(val));
+  }
+};
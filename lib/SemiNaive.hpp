@@ -0,0 +1,116 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "Instrument.hpp"
+#include "Semiring.hpp"
+#include "SpGEMM.hpp"
+#include "SparseAccumulator.hpp"
+#include "ThreadPool.hpp"
+#include <cassert>
+#include <vector>
+
+// Semi-naive (delta-driven) closure: instead of recomputing X (x) X every
+// round, only the entries that improved in the previous round (the delta)
+// are extended by one more edge of A. Row i is independent of every other
+// row, so each row runs its own rounds until its delta is empty:
+//
+//   D = delta = A(i, :)
+//   while delta is not empty:
+//     for (k, d) in delta, (j, w) in A(k, :):
+//       if D(j) (+) d (x) w improves D(j): update it, j joins the next delta
+//
+// Work is proportional to the number of improvements times the degree of
+// the improved vertices, not to nnz(X) per round. The result equals
+// SparseMatrix::closure<S>() for an idempotent S.
+
+// Per-worker scratch for semiNaiveRow, reused across rows.
+template <typename T> struct SemiNaiveScratch {
+  SparseAccumulator<T> dist;
+  std::vector<char> queued;
+  std::vector<size_t> delta, next;
+
+  void resize(size_t n) {
+    if (dist.size() != n) {
+      dist.resize(n);
+      queued.assign(n, 0);
+    }
+  }
+
+  // bytes held for an n-column operand
+  static size_t footprint(size_t n) {
+    return n * (sizeof(T) + 2 * sizeof(char) + 3 * sizeof(size_t));
+  }
+};
+
+// Leaves closure row i of a in s.dist; the caller flushes it. a is any
+// storage with forEachInRow (CSRMatrix or a form from CompactCSR.hpp); its
+// weights are widened to S's type as they are read. improved(j, k) is
+// called on every improvement (see SparseAccumulator.hpp).
+template <typename S, typename M, typename Improved = IgnoreImprovements>
+void semiNaiveRow(const M &a, size_t i,
+                  SemiNaiveScratch<typename S::value_type> &s,
+                  Improved improved = Improved()) {
+  typedef typename S::value_type T;
+  typedef typename M::value_type W;
+  auto add = [](const T &x, const T &y) { return S::add(x, y); };
+  s.delta.clear();
+  a.forEachInRow(i, [&](size_t j, const W &w) {
+    // rows hold each column once, so every arc inserts
+    s.dist.accumulate(j, T(w), add);
+    improved(j, fromSource);
+    s.delta.push_back(j);
+  });
+
+  while (!s.delta.empty()) {
+    s.next.clear();
+    for (size_t k : s.delta) {
+      const T d = s.dist.at(k);
+      a.forEachInRow(k, [&](size_t j, const W &w) {
+        if (s.dist.improve(j, S::mul(d, T(w)), add)) {
+          improved(j, k);
+          if (!s.queued[j]) {
+            s.queued[j] = 1;
+            s.next.push_back(j);
+          }
+        }
+      });
+    }
+    for (size_t j : s.next)
+      s.queued[j] = 0;
+    s.delta.swap(s.next);
+  }
+}
+
+template <typename S, typename M>
+CSRMatrix<typename S::value_type> semiNaiveClosure(const M &a,
+                                                   thread_pool *pool = nullptr) {
+  typedef typename S::value_type T;
+  static_assert(S::idempotent, "semi-naive closure needs an idempotent S");
+  assert(a.getNumRows() == a.getNumCols());
+  MATRICES_PHASE("closure.seminaive");
+  size_t n = a.getNumRows();
+
+  std::vector<std::vector<size_t>> rowCols(n);
+  std::vector<std::vector<T>> rowVals(n);
+  std::vector<SemiNaiveScratch<T>> scratch(workerSlots(pool));
+
+  forEachRange(pool, n, [&](size_t begin, size_t end) {
+    SemiNaiveScratch<T> &s = scratch[workerSlot(pool)];
+    s.resize(n);
+    for (size_t i = begin; i < end; i++) {
+      semiNaiveRow<S>(a, i, s);
+      auto &c = rowCols[i];
+      auto &v = rowVals[i];
+      c.reserve(s.dist.nnz());
+      v.reserve(s.dist.nnz());
+      s.dist.flush([&c, &v](size_t col, const T &value) {
+        if (value != T(0)) {
+          c.push_back(col);
+          v.push_back(value);
+        }
+      });
+    }
+  });
+
+  return concatRows(n, rowCols, rowVals, pool);
+}
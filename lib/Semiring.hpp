@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+
+// Semirings for the generic kernels. Each one provides:
+//   zero()   identity of add, absorbing for mul ("no path")
+//   one()    identity of mul
+//   add(x,y) combines alternatives (sum, min, max, or)
+//   mul(x,y) extends a path by one edge (product, sum, min, and)
+// Everything is static and inline, so a kernel instantiated for a semiring
+// compiles down to the same loop as a hand-written one.
+//
+// Sparse storage keeps the repo's convention that T(0) means "absent";
+// zero() only shows up in dense tiles.
+
+// (+, x): ordinary matrix product
+template <typename T> struct PlusTimes {
+  typedef T value_type;
+  static const bool idempotent = false;
+
+  static T zero() { return T(0); }
+  static T one() { return T(1); }
+  static T add(const T &x, const T &y) { return x + y; }
+  static T mul(const T &x, const T &y) { return x * y; }
+};
+
+// (min, +): shortest paths, the diamond product
+template <typename T> struct MinPlus {
+  typedef T value_type;
+  static const bool idempotent = true;
+
+  static T zero() {
+    return std::numeric_limits<T>::has_infinity
+               ? std::numeric_limits<T>::infinity()
+               : std::numeric_limits<T>::max();
+  }
+  static T one() { return T(0); }
+  static T add(const T &x, const T &y) { return std::min(x, y); }
+  // infinity absorbs on its own; integer types saturate at max() so dense
+  // tiles never overflow past "no path"
+  static T mul(const T &x, const T &y) {
+    if (std::numeric_limits<T>::has_infinity)
+      return x + y;
+    return (x == zero() || y == zero()) ? zero() : T(x + y);
+  }
+};
+
+// (max, +): longest paths on DAGs, critical paths
+template <typename T> struct MaxPlus {
+  typedef T value_type;
+  static const bool idempotent = true;
+
+  static T zero() {
+    return std::numeric_limits<T>::has_infinity
+               ? -std::numeric_limits<T>::infinity()
+               : std::numeric_limits<T>::lowest();
+  }
+  static T one() { return T(0); }
+  static T add(const T &x, const T &y) { return std::max(x, y); }
+  static T mul(const T &x, const T &y) {
+    if (std::numeric_limits<T>::has_infinity)
+      return x + y;
+    return (x == zero() || y == zero()) ? zero() : T(x + y);
+  }
+};
+
+// (max, min): widest (bottleneck) paths
+template <typename T> struct MaxMin {
+  typedef T value_type;
+  static const bool idempotent = true;
+
+  static T zero() { return std::numeric_limits<T>::lowest(); }
+  static T one() { return std::numeric_limits<T>::max(); }
+  static T add(const T &x, const T &y) { return std::max(x, y); }
+  static T mul(const T &x, const T &y) { return std::min(x, y); }
+};
+
+// (or, and): reachability; any nonzero value counts as an edge
+template <typename T> struct OrAnd {
+  typedef T value_type;
+  static const bool idempotent = true;
+
+  static T zero() { return T(0); }
+  static T one() { return T(1); }
+  static T add(const T &x, const T &y) {
+    return (x != T(0) || y != T(0)) ? T(1) : T(0);
+  }
+  static T mul(const T &x, const T &y) {
+    return (x != T(0) && y != T(0)) ? T(1) : T(0);
+  }
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "Instrument.hpp"
+#include "Semiring.hpp"
+#include "SparseAccumulator.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <vector>
+
+// Generic sparse matrix product C = A (x) B over a semiring S, Gustavson
+// style: row i of C is the S::add combination of S::mul(a(i, k), b(k, :))
+// over the entries of row i of A, built in a SparseAccumulator. Every
+// kernel takes an optional pool; without one it runs on the calling thread.
+
+// Runs f(begin, end) over [0, n) on the pool, or inline without one.
+template <typename Function>
+void forEachRange(thread_pool *pool, size_t n, Function f) {
+  if (pool)
+    pool->parallel_for(0, n, 0, f);
+  else if (n)
+    f(0, n);
+}
+
+// Per-worker scratch: one slot per pool worker plus the calling thread.
+// A kernel allocates workerSlots() buffers per call and indexes them with
+// workerSlot() inside its ranges. No two pieces of one call ever hold the
+// same slot at once, even with several threads sharing the pool or with
+// nested calls, because a waiting thread only helps with pieces of its own
+// call (see thread_pool). Scratch must therefore be per call, never shared
+// between calls.
+inline size_t workerSlots(thread_pool *pool) {
+  return pool ? pool->size() + 1 : 1;
+}
+
+inline size_t workerSlot(thread_pool *pool) {
+  return pool ? pool->current_worker() : 0;
+}
+
+// spa (+)= a(i, :) (x) b
+template <typename S, typename T>
+inline void spgemmRow(const CSRMatrix<T> &a, size_t i, const CSRMatrix<T> &b,
+                      SparseAccumulator<T> &spa) {
+  auto add = [](const T &x, const T &y) { return S::add(x, y); };
+  for (size_t p = a.rowBegin(i); p < a.rowEnd(i); p++) {
+    size_t k = a.col(p);
+    const T &val = a.value(p);
+    for (size_t q = b.rowBegin(k); q < b.rowEnd(k); q++) {
+      spa.accumulate(b.col(q), S::mul(val, b.value(q)), add);
+    }
+  }
+}
+
+// Gathers independently built rows into one CSR matrix, for kernels that
+// cannot size their rows up front.
+template <typename T>
+CSRMatrix<T> concatRows(size_t cols, std::vector<std::vector<size_t>> &rowCols,
+                        std::vector<std::vector<T>> &rowVals,
+                        thread_pool *pool) {
+  MATRICES_PHASE("spgemm.gather");
+  size_t n = rowCols.size();
+  std::vector<size_t> ptr(n + 1, 0);
+  for (size_t i = 0; i < n; i++)
+    ptr[i + 1] = ptr[i] + rowCols[i].size();
+
+  std::vector<size_t> idx(ptr[n]);
+  std::vector<T> val(ptr[n]);
+  forEachRange(pool, n, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      std::copy(rowCols[i].begin(), rowCols[i].end(), idx.begin() + ptr[i]);
+      std::copy(rowVals[i].begin(), rowVals[i].end(), val.begin() + ptr[i]);
+      std::vector<size_t>().swap(rowCols[i]);
+      std::vector<T>().swap(rowVals[i]);
+    }
+  });
+  return CSRMatrix<T>(n, cols, std::move(ptr), std::move(idx), std::move(val));
+}
+
+// Bytes of a CSR matrix with the given shape and nnz.
+template <typename T> size_t csrBytes(size_t rows, size_t nnz) {
+  return (rows + 1) * sizeof(size_t) + nnz * (sizeof(size_t) + sizeof(T));
+}
+
+// Symbolic phase: the row offsets of C (+) A (x) B (or A (x) B without c)
+// from the sparsity patterns alone, marking each reachable column once per
+// row. Exact unless values cancel to zero in the numeric phase, so
+// back() is the result's nnz and csrBytes() its size before any value is
+// computed. This form fills ptr in place, reusing its capacity. If
+// products is given it is set to the number of scalar products the
+// numeric phase will form (the sum over the entries a(i, k) of the length
+// of row k of b), counted on the way at no extra pass.
+template <typename T>
+void spgemmSymbolic(const CSRMatrix<T> &a, const CSRMatrix<T> &b,
+                    const CSRMatrix<T> *c, thread_pool *pool,
+                    std::vector<size_t> &ptr, size_t *products = nullptr) {
+  assert(a.getNumCols() == b.getNumRows());
+  MATRICES_PHASE("spgemm.symbolic");
+  size_t n = a.getNumRows();
+  ptr.assign(n + 1, 0);
+  // mark[j] == i + 1 once column j is counted for row i
+  std::vector<std::vector<size_t>> marks(workerSlots(pool));
+  std::atomic<size_t> formed(0);
+
+  forEachRange(pool, n, [&](size_t begin, size_t end) {
+    std::vector<size_t> &mark = marks[workerSlot(pool)];
+    if (mark.size() != b.getNumCols())
+      mark.assign(b.getNumCols(), 0);
+    size_t rangeProducts = 0;
+    for (size_t i = begin; i < end; i++) {
+      size_t count = 0;
+      if (c) {
+        for (size_t p = c->rowBegin(i); p < c->rowEnd(i); p++)
+          mark[c->col(p)] = i + 1;
+        count = c->rowSize(i);
+      }
+      for (size_t p = a.rowBegin(i); p < a.rowEnd(i); p++) {
+        size_t k = a.col(p);
+        rangeProducts += b.rowEnd(k) - b.rowBegin(k);
+        for (size_t q = b.rowBegin(k); q < b.rowEnd(k); q++) {
+          // branch-free: whether a column repeats is close to random
+          size_t j = b.col(q);
+          count += mark[j] != i + 1;
+          mark[j] = i + 1;
+        }
+      }
+      ptr[i + 1] = count;
+    }
+    formed += rangeProducts;
+  });
+
+  for (size_t i = 0; i < n; i++)
+    ptr[i + 1] += ptr[i];
+  if (products)
+    *products = formed;
+}
+
+template <typename T>
+std::vector<size_t> spgemmSymbolic(const CSRMatrix<T> &a, const CSRMatrix<T> &b,
+                                   const CSRMatrix<T> *c = nullptr,
+                                   thread_pool *pool = nullptr) {
+  std::vector<size_t> ptr;
+  spgemmSymbolic(a, b, c, pool, ptr);
+  return ptr;
+}
+
+// Predicted size in bytes of A (x) B, from the symbolic phase.
+template <typename T>
+size_t spgemmFootprint(const CSRMatrix<T> &a, const CSRMatrix<T> &b,
+                       thread_pool *pool = nullptr) {
+  std::vector<size_t> ptr =
+      spgemmSymbolic(a, b, static_cast<const CSRMatrix<T> *>(nullptr), pool);
+  return csrBytes<T>(a.getNumRows(), ptr.back());
+}
+
+// Numeric phase: C (+) A (x) B when c is given, plain A (x) B otherwise,
+// written straight into arrays sized from buf.ptr (see spgemmSymbolic),
+// with no per-row or per-entry allocation. buf.idx and buf.val may hold
+// the arrays of a released matrix; their capacity is reused when it is
+// enough. If changed is given it is set when
+// some row of the result differs from the same row of c; for an
+// idempotent S the result always contains c, so equal nnz and equal
+// values mean the row did not move. The check happens while each row is
+// emitted, with no extra pass over the matrix.
+template <typename S, typename T>
+CSRMatrix<T> spgemmNumeric(const CSRMatrix<T> &a, const CSRMatrix<T> &b,
+                           const CSRMatrix<T> *c, CSRBuffers<T> buf,
+                           thread_pool *pool, bool *changed) {
+  assert(a.getNumCols() == b.getNumRows());
+  assert(buf.ptr.size() == a.getNumRows() + 1);
+  MATRICES_PHASE("spgemm.numeric");
+  size_t n = a.getNumRows();
+  std::vector<size_t> &ptr = buf.ptr;
+  std::vector<size_t> &idx = buf.idx;
+  std::vector<T> &val = buf.val;
+  // too small: drop the old arrays first rather than copy them over
+  if (idx.capacity() < ptr[n])
+    std::vector<size_t>().swap(idx);
+  if (val.capacity() < ptr[n])
+    std::vector<T>().swap(val);
+  idx.resize(ptr[n]);
+  val.resize(ptr[n]);
+  std::atomic_bool anyChange(false), anyShort(false);
+  std::vector<SparseAccumulator<T>> spas(workerSlots(pool));
+  auto add = [](const T &x, const T &y) { return S::add(x, y); };
+
+  forEachRange(pool, n, [&](size_t begin, size_t end) {
+    SparseAccumulator<T> &spa = spas[workerSlot(pool)];
+    if (spa.size() != b.getNumCols())
+      spa.resize(b.getNumCols());
+    bool rangeChange = false;
+    for (size_t i = begin; i < end; i++) {
+      if (c) {
+        for (size_t p = c->rowBegin(i); p < c->rowEnd(i); p++)
+          spa.accumulate(c->col(p), c->value(p), add);
+      }
+      spgemmRow<S>(a, i, b, spa);
+      assert(spa.nnz() == ptr[i + 1] - ptr[i]);
+      size_t out = ptr[i];
+      spa.flush([&](size_t col, const T &value) {
+        if (value != T(0)) {
+          idx[out] = col;
+          val[out] = value;
+          out++;
+        }
+      });
+      if (out != ptr[i + 1]) {
+        // entries cancelled out to the storage zero; mark the unused tail
+        std::fill(idx.begin() + out, idx.begin() + ptr[i + 1], size_t(-1));
+        anyShort = true;
+      }
+      if (changed && c && !rangeChange) {
+        rangeChange = out - ptr[i] != c->rowSize(i) ||
+                      !std::equal(val.begin() + ptr[i], val.begin() + out,
+                                  c->getValues() + c->rowBegin(i));
+      }
+    }
+    if (rangeChange)
+      anyChange = true;
+  });
+
+  if (anyShort) {
+    // squeeze out the gaps left by cancelled entries; rows only move left
+    size_t out = 0;
+    for (size_t i = 0; i < n; i++) {
+      size_t begin = ptr[i];
+      size_t end = begin;
+      while (end < ptr[i + 1] && idx[end] != size_t(-1))
+        end++;
+      ptr[i] = out;
+      std::copy(idx.begin() + begin, idx.begin() + end, idx.begin() + out);
+      std::copy(val.begin() + begin, val.begin() + end, val.begin() + out);
+      out += end - begin;
+    }
+    ptr[n] = out;
+    idx.resize(out);
+    val.resize(out);
+  }
+
+  if (changed)
+    *changed = anyChange;
+  MATRICES_COUNT("spgemm.nnz", ptr[n]);
+  return CSRMatrix<T>(n, b.getNumCols(), std::move(ptr), std::move(idx),
+                      std::move(val));
+}
+
+// Two-phase product: symbolic sizing, then numeric fill into buf.
+template <typename S, typename T>
+CSRMatrix<T> spgemmRows(const CSRMatrix<T> &a, const CSRMatrix<T> &b,
+                        const CSRMatrix<T> *c, thread_pool *pool,
+                        bool *changed, CSRBuffers<T> buf = CSRBuffers<T>()) {
+  MATRICES_PHASE("spgemm");
+  size_t products = 0;
+  spgemmSymbolic(a, b, c, pool, buf.ptr, &products);
+  MATRICES_COUNT("spgemm.products", products);
+  return spgemmNumeric<S>(a, b, c, std::move(buf), pool, changed);
+}
+
+template <typename S, typename T>
+CSRMatrix<T> spgemm(const CSRMatrix<T> &a, const CSRMatrix<T> &b,
+                    thread_pool *pool = nullptr) {
+  return spgemmRows<S>(a, b, static_cast<const CSRMatrix<T> *>(nullptr), pool,
+                       nullptr);
+}
+
+// out = A (x) B, reusing the arrays out already owns; out may alias a or b.
+template <typename S, typename T>
+void spgemm(const CSRMatrix<T> &a, const CSRMatrix<T> &b, CSRMatrix<T> &out,
+            thread_pool *pool = nullptr) {
+  CSRBuffers<T> buf;
+  if (&out != &a && &out != &b)
+    buf = out.release();
+  out = spgemmRows<S>(a, b, static_cast<const CSRMatrix<T> *>(nullptr), pool,
+                      nullptr, std::move(buf));
+}
+
+// C (+) A (x) B, reporting whether any entry of C changed.
+template <typename S, typename T>
+CSRMatrix<T> spgemmUpdate(const CSRMatrix<T> &c, const CSRMatrix<T> &a,
+                          const CSRMatrix<T> &b, bool &changed,
+                          thread_pool *pool = nullptr) {
+  assert(c.getNumRows() == a.getNumRows() && c.getNumCols() == b.getNumCols());
+  return spgemmRows<S>(a, b, &c, pool, &changed);
+}
+
+// Element-wise C = A (+) B, merging the sorted rows.
+template <typename S, typename T>
+CSRMatrix<T> ewiseAdd(const CSRMatrix<T> &a, const CSRMatrix<T> &b) {
+  assert(a.getNumRows() == b.getNumRows() && a.getNumCols() == b.getNumCols());
+  CSRBuilder<T> builder(a.getNumRows(), a.getNumCols(), a.nnz() + b.nnz());
+  for (size_t i = 0; i < a.getNumRows(); i++) {
+    size_t p = a.rowBegin(i), q = b.rowBegin(i);
+    while (p < a.rowEnd(i) || q < b.rowEnd(i)) {
+      if (q == b.rowEnd(i) || (p < a.rowEnd(i) && a.col(p) < b.col(q))) {
+        builder.push(a.col(p), a.value(p));
+        p++;
+      } else if (p == a.rowEnd(i) || b.col(q) < a.col(p)) {
+        builder.push(b.col(q), b.value(q));
+        q++;
+      } else {
+        builder.push(a.col(p), S::add(a.value(p), b.value(q)));
+        p++;
+        q++;
+      }
+    }
+    builder.finishRow();
+  }
+  return builder.build();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+// Gustavson sparse accumulator (SPA) for building one output row at a time:
+// a dense value array indexed by column, an occupancy flag per column and
+// the list of touched columns, so resetting costs O(row nnz), not O(cols).
+// Not thread safe; parallel kernels keep one per worker.
+template <typename T> class SparseAccumulator {
+private:
+  std::vector<T> values;
+  std::vector<char> used;
+  std::vector<size_t> touched;
+
+public:
+  SparseAccumulator() {}
+  explicit SparseAccumulator(size_t n) : values(n), used(n, 0) {}
+
+  size_t size() const { return values.size(); }
+  bool empty() const { return touched.empty(); }
+  size_t nnz() const { return touched.size(); }
+
+  bool contains(size_t col) const { return used[col] != 0; }
+  const T &at(size_t col) const { return values[col]; }
+
+  void resize(size_t n) {
+    assert(touched.empty());
+    values.assign(n, T());
+    used.assign(n, 0);
+  }
+
+  // values[col] = combine(values[col], v), or v if col is untouched
+  template <typename Combine>
+  void accumulate(size_t col, const T &v, Combine combine) {
+    if (!used[col]) {
+      used[col] = 1;
+      values[col] = v;
+      touched.push_back(col);
+    } else {
+      values[col] = combine(values[col], v);
+    }
+  }
+
+  // Like accumulate, but reports whether values[col] was inserted or
+  // actually changed by the combine; used by relaxation kernels.
+  template <typename Combine>
+  bool improve(size_t col, const T &v, Combine combine) {
+    if (!used[col]) {
+      used[col] = 1;
+      values[col] = v;
+      touched.push_back(col);
+      return true;
+    }
+    T next = combine(values[col], v);
+    if (next == values[col])
+      return false;
+    values[col] = next;
+    return true;
+  }
+
+  // Calls emit(col, value) in ascending column order and resets the SPA.
+  template <typename Emit> void flush(Emit emit) {
+    // a nearly full row is cheaper to scan than to sort
+    if (touched.size() * 16 > values.size()) {
+      for (size_t c = 0; c < values.size(); c++) {
+        if (used[c]) {
+          emit(c, values[c]);
+          used[c] = 0;
+        }
+      }
+    } else {
+      std::sort(touched.begin(), touched.end());
+      for (size_t c : touched) {
+        emit(c, values[c]);
+        used[c] = 0;
+      }
+    }
+    touched.clear();
+  }
+};
+
+// Hook of the relaxation kernels (dijkstraRow, semiNaiveRow), called as
+// f(j, k) each time column j of the row improves through vertex k, or with
+// k == fromSource when it improves by an arc out of the source itself.
+// The default does nothing and compiles away; PathClosure.hpp uses it to
+// record the predecessor of every entry.
+const size_t fromSource = size_t(-1);
+
+struct IgnoreImprovements {
+  void operator()(size_t, size_t) const {}
+};
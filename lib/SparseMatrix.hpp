@@ -1,6 +1,17 @@
 #pragma once
 
+#include "AutoClosure.hpp"
+#include "BoundedClosure.hpp"
+#include "CSRMatrix.hpp"
+#include "Closure.hpp"
+#include "DenseMatrix.hpp"
+#include "PathClosure.hpp"
+#include "SemiNaive.hpp"
+#include "Semiring.hpp"
+#include "SpGEMM.hpp"
 #include "ThreadPool.hpp"
+#include "TileKernel.hpp"
+#include "Triplets.hpp"
 #include <cassert>
 #include <cmath>
 #include <iostream>
@@ -17,13 +28,17 @@ private:
   vector<map<size_t, T>> vals;
 
 public:
+  typedef T value_type;
+
   SparseMatrix() : rows(0), cols(0), vals() {}
   SparseMatrix(size_t r, size_t c) : rows(r), cols(c), vals(r) {}
-  // SparseMatrix(const SparseMatrix<T> &) = default;
-  // SparseMatrix(SparseMatrix<T> &&) = default;
-  //
-  // SparseMatrix<T> &operator=(const SparseMatrix<T> &other) = default;
-  // SparseMatrix<T> &operator=(SparseMatrix &&other) = default;
+  explicit SparseMatrix(const CSRMatrix<T> &csr)
+      : rows(csr.getNumRows()), cols(csr.getNumCols()), vals(csr.toRows()) {}
+  SparseMatrix(const SparseMatrix<T> &) = default;
+  SparseMatrix(SparseMatrix<T> &&) = default;
+
+  SparseMatrix<T> &operator=(const SparseMatrix<T> &other) = default;
+  SparseMatrix<T> &operator=(SparseMatrix &&other) = default;
 
   // getters
   size_t getNumRows() const { return rows; }
@@ -32,6 +47,28 @@ public:
 
   const vector<map<size_t, T>> &getVals() const { return vals; }
 
+  CSRMatrix<T> toCSR() const { return CSRMatrix<T>::fromRows(cols, vals); }
+
+  // Bulk construction from unsorted (row, col, value) triplets; duplicate
+  // coordinates are folded with combine (see csrFromTriplets).
+  template <typename Combine>
+  static SparseMatrix<T> fromTriplets(size_t r, size_t c,
+                                      vector<Triplet<T>> triplets,
+                                      Combine combine,
+                                      thread_pool *pool = nullptr) {
+    return SparseMatrix<T>(
+        csrFromTriplets(r, c, std::move(triplets), combine, pool));
+  }
+
+  // duplicates are summed
+  static SparseMatrix<T> fromTriplets(size_t r, size_t c,
+                                      vector<Triplet<T>> triplets,
+                                      thread_pool *pool = nullptr) {
+    return fromTriplets(
+        r, c, std::move(triplets),
+        [](const T &x, const T &y) { return x + y; }, pool);
+  }
+
   const T get(size_t i, size_t j) const {
     auto &r = vals[i];
     auto v = r.find(j);
@@ -45,6 +82,13 @@ public:
   // get row
   const map<size_t, T> &operator()(size_t r) const { return vals[r]; }
 
+  // f(col, value) for each entry of row r in column order, the visitor the
+  // CSR kernels take (see CSRMatrix::forEachInRow)
+  template <typename F> void forEachInRow(size_t r, F f) const {
+    for (const auto &it : vals[r])
+      f(it.first, it.second);
+  }
+
   // setters
   void resize(size_t r, size_t c) {
     rows = r;
@@ -63,6 +107,33 @@ public:
     }
   }
 
+  // Overwrites this matrix with m in place: the row vector is kept and so
+  // is the map node of every entry whose column survives, which is nearly
+  // all of them when the same matrix is refilled round after round.
+  void assign(const CSRMatrix<T> &m) {
+    rows = m.getNumRows();
+    cols = m.getNumCols();
+    vals.resize(rows);
+    for (size_t i = 0; i < rows; i++) {
+      auto &r = vals[i];
+      auto it = r.begin();
+      size_t p = m.rowBegin(i);
+      while (p < m.rowEnd(i)) {
+        if (it == r.end() || m.col(p) < it->first) {
+          r.emplace_hint(it, m.col(p), m.value(p));
+          p++;
+        } else if (it->first < m.col(p)) {
+          it = r.erase(it);
+        } else {
+          it->second = m.value(p);
+          ++it;
+          p++;
+        }
+      }
+      r.erase(it, r.end());
+    }
+  }
+
   bool setData(const vector<T> &other) {
     if (other.size() == rows * cols) {
       for (size_t i = 0, r = 0; i < other.size(); i += cols, r++) {
@@ -83,168 +154,124 @@ public:
     return count;
   }
 
-  // sequential operations
-  SparseMatrix<T> operator*(const SparseMatrix<T> &other) {
+  // generic operations over a semiring S (see Semiring.hpp); every
+  // specialised operation below is one of these instantiated for its algebra
+  template <typename S>
+  SparseMatrix<T> multiply(const SparseMatrix<T> &other,
+                           thread_pool *pool = nullptr) const {
     assert(cols == other.getNumRows());
-    SparseMatrix<T> result(rows, other.getNumCols());
-
-    for (size_t i = 0; i < rows; i++) {
-      const auto &row = vals[i];
-      for (const auto &j : row) {
-        const auto &othRow = other(j.first);
-        for (const auto &k : othRow) {
-          result.set(result.get(i, k.first) + (k.second * j.second), i,
-                     k.first);
-        }
-      }
-    }
-
-    return result;
-  }
-
-  bool compare(SparseMatrix<T> &m2) const {
-    for (size_t i = 0; i < rows; i++) {
-      const auto &r = m2(i);
-      for (const auto &it : r) {
-        if (it.second != get(i, it.first))
-          return false;
-      }
-    }
-    return true;
+    return SparseMatrix<T>(spgemm<S>(toCSR(), other.toCSR(), pool));
   }
 
-  SparseMatrix<T> diamond() {
-    SparseMatrix<T> other(*this);
+  // Output-parameter forms: the result goes into out through assign(), so
+  // a matrix reused across iterations keeps its storage; out may be *this
+  // or the other operand.
+  template <typename S>
+  void multiply(const SparseMatrix<T> &other, SparseMatrix<T> &out,
+                thread_pool *pool = nullptr) const {
     assert(cols == other.getNumRows());
-    SparseMatrix<T> result(rows, other.getNumCols());
-    size_t exp = rows - 1;
-
-    auto diamond_once = [&](const SparseMatrix<T> &m) {
-      SparseMatrix<T> result(rows, m.getNumCols());
-      for (size_t i = 0; i < rows; i++) {
-        const auto &row = vals[i];
-        for (const auto &j : row) {
-          const auto &othRow = m(j.first);
-          for (const auto &k : othRow) {
-            if (result.get(i, k.first) == T(0)) {
-              result.set(k.second + j.second, i, k.first);
-            } else {
-              T aux = min(result.get(i, k.first), k.second + j.second);
-              result.set(aux, i, k.first);
-            }
-          }
-        }
-      }
-      return result;
-    };
-
-    // optimization => log2(rows - 1) iterations
-    while (exp) {
-      if (exp & 1) {
-        result = diamond_once(other);
-      }
-      other = diamond_once(other);
-      exp >>= 1;
-    }
+    out.assign(spgemm<S>(toCSR(), other.toCSR(), pool));
+  }
 
-    return result;
+  template <typename S>
+  void add(const SparseMatrix<T> &b, SparseMatrix<T> &out) const {
+    assert(rows == b.getNumRows() && cols == b.getNumCols());
+    out.assign(ewiseAdd<S>(toCSR(), b.toCSR()));
   }
 
-  // concurrent operations
-  SparseMatrix<T> multConcurrent(const SparseMatrix<T> &m2) {
+  template <typename S>
+  void closure(SparseMatrix<T> &out, thread_pool *pool = nullptr,
+               double denseThreshold = 0.1) const {
+    assert(cols == rows);
+    out.assign(squaringClosure<S>(toCSR(), pool, denseThreshold));
+  }
 
-    // Check
-    assert(cols == m2.getNumRows());
+  // Transitive closure over an idempotent S by repeated squaring with an
+  // early exit and a dense Floyd-Warshall hand-off (see Closure.hpp); the
+  // min-plus closure holds the shortest path with at least one edge.
+  template <typename S>
+  SparseMatrix<T> closure(thread_pool *pool = nullptr,
+                          double denseThreshold = 0.1) const {
+    assert(cols == rows);
+    return SparseMatrix<T>(squaringClosure<S>(toCSR(), pool, denseThreshold));
+  }
 
-    thread_pool *pool = new thread_pool();
-    SparseMatrix<T> result(rows, m2.getNumCols());
+  // Same result as closure<S>(), always on the dense Floyd-Warshall engine.
+  template <typename S>
+  SparseMatrix<T> closureDense(thread_pool *pool = nullptr) const {
+    assert(cols == rows);
+    return SparseMatrix<T>(denseClosure<S>(toCSR(), pool));
+  }
 
-    auto multRow = [&](size_t nRow) {
-      // get row
-      const auto &row = vals[nRow];
-      for (const auto &j : row) {
-        const auto &othRow = m2(j.first);
-        for (const auto &it : othRow) {
-          result.set(result.get(nRow, it.first) + (it.second * j.second), nRow,
-                     it.first);
-        }
-      }
-    };
+  // Same result as closure<S>(), computed by semi-naive relaxation (see
+  // SemiNaive.hpp); cheaper when most entries settle after a few rounds.
+  template <typename S>
+  SparseMatrix<T> closureSemiNaive(thread_pool *pool = nullptr) const {
+    assert(cols == rows);
+    return SparseMatrix<T>(semiNaiveClosure<S>(toCSR(), pool));
+  }
 
-    for (size_t i = 0; i < rows; i++) {
-      auto func = [&multRow, i] { multRow(i); };
-      pool->submit(func);
-    }
+  // Same result as closure<S>(), one Dijkstra search per source row (see
+  // Dijkstra.hpp); throws std::domain_error when the weights rule it out.
+  template <typename S>
+  SparseMatrix<T> closureDijkstra(thread_pool *pool = nullptr) const {
+    assert(cols == rows);
+    return SparseMatrix<T>(dijkstraClosure<S>(toCSR(), pool));
+  }
 
-    delete pool;
+  // Same result as closure<S>(), on squaring or per-source Dijkstra,
+  // whichever the cost model in AutoClosure.hpp expects to be cheaper.
+  template <typename S>
+  SparseMatrix<T> closureAuto(thread_pool *pool = nullptr) const {
+    assert(cols == rows);
+    return SparseMatrix<T>(autoClosure<S>(toCSR(), pool));
+  }
 
-    return result;
+  template <typename S>
+  void closureAuto(SparseMatrix<T> &out, thread_pool *pool = nullptr) const {
+    assert(cols == rows);
+    out.assign(autoClosure<S>(toCSR(), pool));
   }
 
-  SparseMatrix<T> partition(size_t offsetRow, size_t offsetCol) const {
-    SparseMatrix<T> sub(rows / 2, cols / 2);
-    for (size_t i = 0; i < rows / 2; i++) {
-      for (size_t j = 0; j < cols / 2; j++) {
-        sub.set(get(i + offsetRow, j + offsetCol), i, j);
-      }
-    }
-    return sub;
+  // The entries of closure<S>() within bounds (see BoundedClosure.hpp);
+  // throws std::domain_error when the weights rule out label setting.
+  template <typename S>
+  SparseMatrix<T> closureBounded(const SearchBounds<T> &bounds,
+                                 thread_pool *pool = nullptr) const {
+    assert(cols == rows);
+    return SparseMatrix<T>(boundedClosure<S>(toCSR(), bounds, pool));
   }
 
-  void rebuild(SparseMatrix<T> &result, size_t offsetRow, size_t offsetCol) {
-    for (size_t i = 0; i < rows; i++) {
-      for (size_t j = 0; j < cols; j++) {
-        result.set(get(i, j), i + offsetRow, j + offsetCol);
-      }
-    }
+  // Same distances as closure<S>(), plus the predecessor of every entry
+  // for path extraction (see PathClosure.hpp).
+  template <typename S>
+  PathClosure<T> closurePaths(thread_pool *pool = nullptr) const {
+    assert(cols == rows);
+    return pathClosure<S>(toCSR(), pool);
   }
 
-  SparseMatrix<T> diamondSeq(const SparseMatrix<T> &b) const {
+  // Dense product on contiguous copies through the tile micro-kernel;
+  // reference kernel and leaf of the block recursion.
+  template <typename S>
+  SparseMatrix<T> multiplyDense(const SparseMatrix<T> &b) const {
     assert(cols == b.getNumRows());
-    SparseMatrix<T> result(rows, b.getNumCols());
-    T oo(numeric_limits<T>::max());
-
-    for (int i = 0; i < rows; i++) {
-      for (int j = 0; j < b.getNumCols(); j++) {
-        T mn = oo;
-        for (int k = 0; k < cols; k++) {
-          if (get(i, k) == T(0) || b.get(k, j) == T(0))
-            continue;
-          // else if (get(i, k) != T(0) && && b.get(k, j) == T(0))
-          mn = min(mn, get(i, k) + b.get(k, j));
-        }
-
-        if (mn != oo)
-          result.set(mn, i, j);
-      }
-    }
-    return result;
+    DenseMatrix<T> c(rows, b.getNumCols(), S::zero());
+    denseMultiplyAdd<S>(c, DenseMatrix<T>::template fromCSR<S>(toCSR()),
+                        DenseMatrix<T>::template fromCSR<S>(b.toCSR()));
+    return SparseMatrix<T>(c.template toCSR<S>());
   }
 
-  SparseMatrix<T> minMatrix(const SparseMatrix<T> &b) const {
-    SparseMatrix<T> result(rows, cols);
-    for (int i = 0; i < rows; i++) {
-      for (int j = 0; j < cols; j++) {
-        T weight1 = get(i, j);
-        T weight2 = b.get(i, j);
-        if (weight1 == T(0) || weight2 == T(0)) {
-          if (weight1 != T(0)) {
-            result.set(weight1, i, j);
-          } else if (weight2 != T(0)) {
-            result.set(weight2, i, j);
-          }
-        } else {
-          result.set(min(weight1, weight2), i, j);
-        }
-      }
-    }
-    return result;
+  template <typename S> SparseMatrix<T> add(const SparseMatrix<T> &b) const {
+    assert(rows == b.getNumRows() && cols == b.getNumCols());
+    return SparseMatrix<T>(ewiseAdd<S>(toCSR(), b.toCSR()));
   }
 
-  SparseMatrix<T> diamond_block_seq(SparseMatrix<T> &m) const {
-    if (rows == 2) {
-      // cout << m << endl;
-      return diamondSeq(m);
+  // Recursive 2x2 block product, for power-of-two sizes; blocks of up to
+  // 64 rows go to the dense micro-kernel.
+  template <typename S>
+  SparseMatrix<T> multiplyBlock(const SparseMatrix<T> &m) const {
+    if (rows <= 64) {
+      return multiplyDense<S>(m);
     } else {
       size_t sizeA = rows / 2;
       size_t sizeB = m.getNumRows() / 2;
@@ -259,14 +286,14 @@ public:
       SparseMatrix<T> b2 = m.partition(sizeB, 0);
       SparseMatrix<T> b3 = m.partition(sizeB, sizeB);
 
-      SparseMatrix<T> r0 =
-          a0.diamond_block_seq(b0).minMatrix(a1.diamond_block_seq(b2));
-      SparseMatrix<T> r1 =
-          a0.diamond_block_seq(b1).minMatrix(a1.diamond_block_seq(b3));
-      SparseMatrix<T> r2 =
-          a2.diamond_block_seq(b0).minMatrix(a3.diamond_block_seq(b2));
-      SparseMatrix<T> r3 =
-          a2.diamond_block_seq(b1).minMatrix(a3.diamond_block_seq(b3));
+      SparseMatrix<T> r0 = a0.template multiplyBlock<S>(b0).template add<S>(
+          a1.template multiplyBlock<S>(b2));
+      SparseMatrix<T> r1 = a0.template multiplyBlock<S>(b1).template add<S>(
+          a1.template multiplyBlock<S>(b3));
+      SparseMatrix<T> r2 = a2.template multiplyBlock<S>(b0).template add<S>(
+          a3.template multiplyBlock<S>(b2));
+      SparseMatrix<T> r3 = a2.template multiplyBlock<S>(b1).template add<S>(
+          a3.template multiplyBlock<S>(b3));
 
       SparseMatrix<T> result(rows, cols);
       size_t sizeResult = result.getNumRows() / 2;
@@ -280,115 +307,110 @@ public:
     }
   }
 
-  SparseMatrix<T> operator+(const SparseMatrix<T> &b) const {
-    SparseMatrix<T> c(rows, cols);
+  // sequential operations
+  SparseMatrix<T> operator*(const SparseMatrix<T> &other) {
+    return multiply<PlusTimes<T>>(other);
+  }
+
+  bool compare(SparseMatrix<T> &m2) const {
     for (size_t i = 0; i < rows; i++) {
-      for (size_t j = 0; j < cols; j++) {
-        c.set(get(i, j) + b.get(i, j), i, j);
+      const auto &r = m2(i);
+      for (const auto &it : r) {
+        if (it.second != get(i, it.first))
+          return false;
       }
     }
+    return true;
+  }
+
+  SparseMatrix<T> diamond() { return closureAuto<MinPlus<T>>(); }
+
+  void diamond(SparseMatrix<T> &out) const { closureAuto<MinPlus<T>>(out); }
 
-    return c;
+  // concurrent operations
+  SparseMatrix<T> multConcurrent(const SparseMatrix<T> &m2) {
+    thread_pool pool;
+    return multConcurrent(m2, pool);
   }
 
-  SparseMatrix<T> multMatrix(const SparseMatrix<T> &m2) {
-    SparseMatrix<T> result(rows, m2.getNumCols());
+  // runs on a caller-owned pool, so back-to-back operations reuse workers
+  SparseMatrix<T> multConcurrent(const SparseMatrix<T> &m2,
+                                 thread_pool &pool) {
+    return multiply<PlusTimes<T>>(m2, &pool);
+  }
+
+  SparseMatrix<T> partition(size_t offsetRow, size_t offsetCol) const {
+    SparseMatrix<T> sub(rows / 2, cols / 2);
+    for (size_t i = 0; i < rows / 2; i++) {
+      for (size_t j = 0; j < cols / 2; j++) {
+        sub.set(get(i + offsetRow, j + offsetCol), i, j);
+      }
+    }
+    return sub;
+  }
+
+  void rebuild(SparseMatrix<T> &result, size_t offsetRow, size_t offsetCol) {
     for (size_t i = 0; i < rows; i++) {
-      for (size_t j = 0; j < m2.getNumCols(); j++) {
-        T accum(0);
-        for (size_t k = 0; k < cols; k++) {
-          if (get(i, k) == T(0) || m2.get(k, j) == T(0))
-            continue;
-          accum += get(i, k) * m2.get(k, j);
-        }
-        result.set(accum, i, j);
+      for (size_t j = 0; j < cols; j++) {
+        result.set(get(i, j), i + offsetRow, j + offsetCol);
       }
     }
+  }
 
-    return result;
+  SparseMatrix<T> diamondSeq(const SparseMatrix<T> &b) const {
+    return multiplyDense<MinPlus<T>>(b);
   }
 
-  SparseMatrix<T> mult_block_seq(const SparseMatrix<T> &m) {
-    if (rows == 2) {
-      return multMatrix(m);
-    } else {
-      size_t sizeA = rows / 2;
-      size_t sizeB = m.getNumRows() / 2;
+  SparseMatrix<T> minMatrix(const SparseMatrix<T> &b) const {
+    return add<MinPlus<T>>(b);
+  }
 
-      SparseMatrix<T> a0 = partition(0, 0);
-      SparseMatrix<T> a1 = partition(0, sizeA);
-      SparseMatrix<T> a2 = partition(sizeA, 0);
-      SparseMatrix<T> a3 = partition(sizeA, sizeA);
+  SparseMatrix<T> diamond_block_seq(SparseMatrix<T> &m) const {
+    return multiplyBlock<MinPlus<T>>(m);
+  }
 
-      SparseMatrix<T> b0 = m.partition(0, 0);
-      SparseMatrix<T> b1 = m.partition(0, sizeB);
-      SparseMatrix<T> b2 = m.partition(sizeB, 0);
-      SparseMatrix<T> b3 = m.partition(sizeB, sizeB);
+  SparseMatrix<T> operator+(const SparseMatrix<T> &b) const {
+    return add<PlusTimes<T>>(b);
+  }
 
-      SparseMatrix<T> r0 = a0.mult_block_seq(b0) + a1.mult_block_seq(b2);
-      SparseMatrix<T> r1 = a0.mult_block_seq(b1) + a1.mult_block_seq(b3);
-      SparseMatrix<T> r2 = a2.mult_block_seq(b0) + a3.mult_block_seq(b2);
-      SparseMatrix<T> r3 = a2.mult_block_seq(b1) + a3.mult_block_seq(b3);
+  SparseMatrix<T> multMatrix(const SparseMatrix<T> &m2) {
+    return multiplyDense<PlusTimes<T>>(m2);
+  }
 
-      SparseMatrix<T> result(rows, cols);
-      size_t sizeResult = result.getNumRows() / 2;
+  SparseMatrix<T> mult_block_seq(const SparseMatrix<T> &m) {
+    return multiplyBlock<PlusTimes<T>>(m);
+  }
 
-      r0.rebuild(result, 0, 0);
-      r1.rebuild(result, 0, sizeResult);
-      r2.rebuild(result, sizeResult, 0);
-      r3.rebuild(result, sizeResult, sizeResult);
+  SparseMatrix<T> diamondConcurrent() const {
+    thread_pool pool;
+    return diamondConcurrent(pool);
+  }
 
-      return result;
-    }
+  SparseMatrix<T> diamondConcurrent(thread_pool &pool) const {
+    return closureAuto<MinPlus<T>>(&pool);
   }
 
-  SparseMatrix<T> diamondConcurrent() const {
-    SparseMatrix<T> m2(*this);
-    // Check
-    assert(cols == m2.getNumRows());
-    SparseMatrix<T> result(rows, m2.getNumCols());
-    size_t exp = rows - 1;
-
-    auto diamondRow = [&](size_t nRow, const SparseMatrix<T> &m,
-                          SparseMatrix<T> &result) {
-      auto &row = vals[nRow];
-      T oo(numeric_limits<T>::max());
-
-      for (const auto &i : row) {
-        const auto &othRow = m(i.first);
-        for (const auto &it : othRow) {
-          if (result.get(nRow, it.first) == 0) {
-            result.set(it.second + i.second, nRow, it.first);
-          }
-          result.set(min(result.get(nRow, it.first), it.second + i.second),
-                     nRow, it.first);
-        }
-      }
-    };
+  void diamondConcurrent(thread_pool &pool, SparseMatrix<T> &out) const {
+    closureAuto<MinPlus<T>>(out, &pool);
+  }
 
-    auto diamond_once = [&](SparseMatrix<T> m) {
-      SparseMatrix<T> result(rows, m.getNumCols());
-      thread_pool *pool = new thread_pool();
+  SparseMatrix<T> diamondSemiNaive(thread_pool &pool) const {
+    return closureSemiNaive<MinPlus<T>>(&pool);
+  }
 
-      for (size_t i = 0; i < rows; i++) {
-        auto func = [&diamondRow, i, &m, &result] { diamondRow(i, m, result); };
-        pool->submit(func);
-      }
+  // the entries of diamond() no longer than radius
+  SparseMatrix<T> diamondWithin(T radius, thread_pool *pool = nullptr) const {
+    return closureBounded<MinPlus<T>>(SearchBounds<T>::within(radius), pool);
+  }
 
-      delete pool;
-      return result;
-    };
+  // the k nearest targets of every row of diamond()
+  SparseMatrix<T> diamondNearest(size_t k, thread_pool *pool = nullptr) const {
+    return closureBounded<MinPlus<T>>(SearchBounds<T>::nearest(k), pool);
+  }
 
-    // optimization => 1 + log2(rows - 1) iterations
-    while (exp) {
-      if (exp & 1) {
-        result = diamond_once(m2);
-      }
-      m2 = diamond_once(m2);
-      exp >>= 1;
-    }
-    // result = diamond_once(m2);
-    return result;
+  // diamond() with routes: result.path(i, j) lists a shortest path
+  PathClosure<T> diamondPaths(thread_pool *pool = nullptr) const {
+    return closurePaths<MinPlus<T>>(pool);
   }
 
   void print() {
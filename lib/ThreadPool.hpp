@@ -1,56 +1,303 @@
 #pragma once
 
-#include "ThreadSafeQueue.hpp"
+#include "Instrument.hpp"
+#include "WorkStealingQueue.hpp"
 // #include "SafeQueue.hpp"
+#include <algorithm>
 #include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
+// A thread that waits, in parallel_for() or wait(), helps with queued tasks
+// of what it waits for and nothing else. So a thread never starts a piece
+// of some other parallel_for call in the middle of its own, and kernels can
+// keep per-call scratch indexed by current_worker() even when several
+// threads share the pool or calls nest.
 class thread_pool {
 private:
+  typedef pool_task task_type;
+
+  // Completion counter for one parallel_for call. count_down runs under the
+  // mutex so the waiter can only observe zero once the last worker is done
+  // touching the latch. Queuing a piece also wakes the waiter, which may be
+  // the only thread free to run it.
+  struct range_latch {
+    size_t remaining;
+    size_t queued; // pieces queued so far
+    std::mutex m;
+    std::condition_variable cv;
+
+    explicit range_latch(size_t count) : remaining(count), queued(0) {}
+
+    void count_down(size_t n) {
+      std::lock_guard<std::mutex> lk(m);
+      remaining -= n;
+      if (remaining == 0)
+        cv.notify_all();
+    }
+
+    // after the piece is in a queue, so a woken waiter finds it
+    void piece_queued() {
+      std::lock_guard<std::mutex> lk(m);
+      ++queued;
+      cv.notify_all();
+    }
+
+    // Whether the call is complete; seen is the pieces queued so far.
+    bool done(size_t &seen) {
+      std::lock_guard<std::mutex> lk(m);
+      seen = queued;
+      return remaining == 0;
+    }
+
+    // Sleeps until the call is complete or a piece was queued after the
+    // waiter counted seen of them.
+    void wait(size_t seen) {
+      std::unique_lock<std::mutex> lk(m);
+      cv.wait(lk, [this, seen] { return remaining == 0 || queued != seen; });
+    }
+  };
+
   std::atomic_bool done;
-  threadsafe_queue<std::function<void()>> work_queue;
+  std::atomic<size_t> pending;
+  std::atomic<size_t> queued;
+  std::atomic<unsigned> sleeping;
+  work_stealing_queue pool_work_queue; // FIFO: pushed front, taken back
   // SafeQueue<std::function<void()>> work_queue;
+  std::vector<std::unique_ptr<work_stealing_queue>> queues;
   std::vector<std::thread> threads;
+  unsigned spin_count;
+  std::mutex wait_mutex;
+  std::condition_variable wait_cond;
+  std::mutex sleep_mutex;
+  std::condition_variable work_cond;
+  MATRICES_INSTRUMENTED(std::vector<instrument::WorkerStats> worker_stats;)
+
+  // scheduling state of the current thread; a worker belongs to one pool
+  static thread_pool *&local_pool() {
+    static thread_local thread_pool *pool = nullptr;
+    return pool;
+  }
+
+  static unsigned &local_index() {
+    static thread_local unsigned index = 0;
+    return index;
+  }
+
+  bool is_worker() const { return local_pool() == this; }
 
-  void worker_thread() {
-    while (!done || !work_queue.empty()) {
-      std::function<void()> task;
-      if (work_queue.try_pop(task)) {
-        task();
-      } else {
+  // Workers push onto their own deque, everybody else onto the shared
+  // queue. queued is bumped first so a sleeping worker that wakes up never
+  // misses the task.
+  void push_task(std::function<void()> run, const void *batch) {
+    task_type task = {std::move(run), batch};
+    ++queued;
+    if (is_worker())
+      queues[local_index()]->push(std::move(task));
+    else
+      pool_work_queue.push(std::move(task));
+    if (sleeping != 0) {
+      std::lock_guard<std::mutex> lk(sleep_mutex);
+      work_cond.notify_one();
+    }
+  }
+
+  bool pop_task(task_type &task) {
+    bool found = false;
+    if (is_worker())
+      found = queues[local_index()]->try_pop(task);
+    if (!found)
+      found = pool_work_queue.try_steal(task);
+    for (size_t i = 0; i < queues.size() && !found; ++i) {
+      size_t index = (local_index() + i + 1) % queues.size();
+      found = queues[index]->try_steal(task);
+      MATRICES_INSTRUMENTED(if (found && is_worker())
+                                worker_stats[local_index()].steals++;)
+    }
+    if (found)
+      --queued;
+    return found;
+  }
+
+  // The oldest queued task of batch, looking in the same order as
+  // pop_task.
+  bool pop_batch_task(task_type &task, const void *batch) {
+    bool found = false;
+    if (is_worker())
+      found = queues[local_index()]->try_take(task, batch);
+    if (!found)
+      found = pool_work_queue.try_take(task, batch);
+    for (size_t i = 0; i < queues.size() && !found; ++i)
+      found = queues[(local_index() + i + 1) % queues.size()]->try_take(task,
+                                                                        batch);
+    if (found)
+      --queued;
+    return found;
+  }
+
+  bool run_pending_task() {
+    task_type task;
+    if (!pop_task(task))
+      return false;
+    task.run();
+    return true;
+  }
+
+  bool run_batch_task(const void *batch) {
+    task_type task;
+    if (!pop_batch_task(task, batch))
+      return false;
+    task.run();
+    return true;
+  }
+
+  void finish_submitted() {
+    if (--pending == 0) {
+      std::lock_guard<std::mutex> lk(wait_mutex);
+      wait_cond.notify_all();
+    }
+  }
+
+  // Runs its own deque first, then the shared queue, then steals. After
+  // spin_count failed rounds the worker sleeps until a task is queued or
+  // the pool shuts down.
+  void worker_thread(unsigned index) {
+    local_pool() = this;
+    local_index() = index;
+#ifdef MATRICES_INSTRUMENT
+    instrument::WorkerStats &stats = worker_stats[index];
+    auto idle_since = instrument::Clock::now();
+    // busy while running a task; the time between two tasks, spent
+    // looking for work (queue contention included), spinning or asleep,
+    // is idle
+    auto run = [&]() {
+      task_type task;
+      if (!pop_task(task))
+        return false;
+      auto start = instrument::Clock::now();
+      stats.idleSeconds += std::chrono::duration_cast<
+          std::chrono::duration<double>>(start - idle_since).count();
+      task.run();
+      stats.tasks++;
+      idle_since = instrument::Clock::now();
+      stats.busySeconds += std::chrono::duration_cast<
+          std::chrono::duration<double>>(idle_since - start).count();
+      return true;
+    };
+#else
+    auto run = [this]() { return run_pending_task(); };
+#endif
+    for (;;) {
+      if (run())
+        continue;
+      bool found = false;
+      for (unsigned spin = 0; spin < spin_count && !found; ++spin) {
         std::this_thread::yield();
+        found = run();
+      }
+      if (found)
+        continue;
+      std::unique_lock<std::mutex> lk(sleep_mutex);
+      ++sleeping;
+      work_cond.wait(lk, [this] { return done || queued != 0; });
+      --sleeping;
+      if (done && queued == 0) {
+        MATRICES_INSTRUMENTED(
+            stats.idleSeconds += instrument::seconds(idle_since);)
+        return;
       }
     }
   }
 
+  // Splits off the upper half of the range as a stealable task until it is
+  // at most grain long, then runs what is left on this thread.
+  template <typename Function>
+  void run_range(size_t begin, size_t end, size_t grain, const Function &f,
+                 range_latch &latch) {
+    while (end - begin > grain) {
+      size_t mid = begin + (end - begin) / 2;
+      push_task([this, mid, end, grain, &f, &latch] {
+        run_range(mid, end, grain, f, latch);
+      }, &latch);
+      latch.piece_queued();
+      end = mid;
+    }
+    f(begin, end);
+    latch.count_down(end - begin);
+  }
+
 public:
-  thread_pool() : done(false) {
+  // spin_count > 0 keeps idle workers polling briefly before they sleep,
+  // trading some CPU for lower wake-up latency on short bursts
+  explicit thread_pool(
+      unsigned thread_count = std::thread::hardware_concurrency(),
+      unsigned spin = 0)
+      : done(false), pending(0), queued(0), sleeping(0), spin_count(spin) {
     // joiner(new join_threads(threads));
-    unsigned const thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0)
+      thread_count = 1;
+    // registry first, so its hardware counters are inherited by the workers
+    MATRICES_INSTRUMENTED(instrument::registry();
+                          worker_stats.resize(thread_count);)
     try {
       for (unsigned i = 0; i < thread_count; ++i) {
-        threads.emplace_back(&thread_pool::worker_thread, this);
+        queues.emplace_back(new work_stealing_queue());
+      }
+      for (unsigned i = 0; i < thread_count; ++i) {
+        threads.emplace_back(&thread_pool::worker_thread, this, i);
       }
     } catch (...) {
-      done = true;
+      shutdown();
       throw;
     }
   }
   ~thread_pool() {
     // joiner->~join_threads();
-    done = true;
-    for (auto &thread : threads) {
-      if (thread.joinable())
-        thread.join();
-    }
+    shutdown();
     // std::string s("Destructing pool ");
     // s += std::to_string(work_queue.empty());
     // s += '\n';
     // std::cerr << s;
   }
 
+  // Lets the workers finish the queued tasks and joins them. Called by the
+  // destructor; submitting after shutdown is not allowed.
+  void shutdown() {
+    {
+      std::lock_guard<std::mutex> lk(sleep_mutex);
+      done = true;
+      work_cond.notify_all();
+    }
+    for (auto &thread : threads) {
+      if (thread.joinable())
+        thread.join();
+    }
+    // cleared so a second shutdown does not report the workers twice
+    MATRICES_INSTRUMENTED(instrument::registry().pool(worker_stats);
+                          worker_stats.clear();)
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  size_t size() const { return threads.size(); }
+
+  // Index of the calling worker in [0, size()), or size() for any thread
+  // outside the pool. Lets kernels keep one scratch buffer per worker plus
+  // one for the caller of parallel_for: pieces of a call only run on pool
+  // workers and on the thread that made the call, which is its only user
+  // of slot size() even when other threads outside the pool run calls of
+  // their own.
+  size_t current_worker() const {
+    return is_worker() ? local_index() : threads.size();
+  }
+
   std::vector<std::thread::id> getThreadIds() const {
     std::vector<std::thread::id> ids;
     for (auto &thread : threads) {
@@ -60,8 +307,52 @@ public:
   }
 
   template <typename FunctionType> void submit(FunctionType f) {
-    work_queue.emplace(f);
-    // work_queue.emplace(f);
+    assert(!done);
+    ++pending;
+    push_task([this, f]() mutable {
+      f();
+      finish_submitted();
+    }, nullptr);
     //    std::cerr << std::this_thread::get_id() << std::endl;
   }
+
+  // Barrier for everything submitted so far. The calling thread helps to
+  // run queued submitted tasks and then sleeps until the workers finish
+  // theirs, so the pool can be reused for the next batch. Must not be
+  // called from inside a task.
+  void wait() {
+    assert(!is_worker());
+    while (pending != 0) {
+      if (!run_batch_task(nullptr)) {
+        std::unique_lock<std::mutex> lk(wait_mutex);
+        wait_cond.wait(lk, [this] { return pending == 0; });
+      }
+    }
+  }
+
+  // Calls f(b, e) on disjoint subranges covering [begin, end) and returns
+  // once all of them ran. Ranges are halved until they are at most grain
+  // long (grain 0 picks about eight pieces per thread); idle workers steal
+  // the larger halves, so rows with uneven cost still balance. Safe to
+  // nest inside tasks and to call from several threads at once; while it
+  // waits, the caller only runs pieces of this call.
+  template <typename Function>
+  void parallel_for(size_t begin, size_t end, size_t grain, Function f) {
+    if (begin >= end)
+      return;
+    if (grain == 0)
+      grain = std::max<size_t>(1, (end - begin) / (8 * (threads.size() + 1)));
+    if (end - begin <= grain) {
+      f(begin, end);
+      return;
+    }
+
+    range_latch latch(end - begin);
+    run_range(begin, end, grain, f, latch);
+    size_t seen;
+    while (!latch.done(seen)) {
+      if (!run_batch_task(&latch))
+        latch.wait(seen);
+    }
+  }
 };
@@ -1,65 +0,0 @@
-#pragma once
-
-#include <condition_variable>
-#include <mutex>
-#include <queue>
-
-template <typename T> class threadsafe_queue {
-private:
-  mutable std::mutex mut;
-  std::queue<T> data_queue;
-  std::condition_variable data_cond;
-
-public:
-  threadsafe_queue() {}
-  void push(T data) {
-    std::lock_guard<std::mutex> lk(mut);
-    data_queue.push(std::move(data));
-    data_cond.notify_one();
-  }
-
-  template <class... Args> T &emplace(Args &&... args) {
-    std::lock_guard<std::mutex> lk(mut);
-    data_queue.emplace(args...);
-    return data_queue.back();
-  }
-
-  void wait_and_pop(T &value) {
-    std::unique_lock<std::mutex> lk(mut);
-    data_cond.wait(lk, [this] { return !data_queue.empty(); });
-    value = std::move(data_queue.front());
-    data_queue.pop();
-  }
-
-  std::shared_ptr<T> wait_and_pop() {
-    std::unique_lock<std::mutex> lk(mut);
-    data_cond.wait(lk, [this] { return !data_queue.empty(); });
-    std::shared_ptr<T> res(std::make_shared<T>(std::move(data_queue.front())));
-
-    data_queue.pop();
-    return res;
-  }
-
-  bool try_pop(T &value) {
-    std::lock_guard<std::mutex> lk(mut);
-    if (data_queue.empty())
-      return false;
-    value = std::move(data_queue.front());
-    data_queue.pop();
-    return true;
-  }
-
-  std::shared_ptr<T> try_pop() {
-    std::lock_guard<std::mutex> lk(mut);
-    if (data_queue.empty())
-      return std::shared_ptr<T>();
-    std::shared_ptr<T> res(std::make_shared<T>(std::move(data_queue.front())));
-    data_queue.pop();
-    return res;
-  }
-
-  bool empty() const {
-    std::lock_guard<std::mutex> lk(mut);
-    return data_queue.empty();
-  }
-};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "DenseMatrix.hpp"
+#include "Semiring.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+
+// Dense tile micro-kernels: C (+)= A (x) B on row-major tiles with explicit
+// leading dimensions. MinPlus and PlusTimes over float/double run a
+// register-blocked SIMD kernel, picked at runtime (AVX2 when the CPU has
+// it, SSE2 otherwise), so one binary runs on every x86-64 host. Every
+// other semiring or type, and non-x86 builds, take the scalar loop.
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <immintrin.h>
+#define MATRICES_TILE_SSE2 1
+// per-function targets via pragma are a GCC feature
+#if defined(__GNUC__) && !defined(__clang__)
+#define MATRICES_TILE_AVX2 1
+#endif
+#endif
+
+#ifdef MATRICES_TILE_SSE2
+namespace tile_sse2 {
+struct VecDouble {
+  typedef __m128d vec;
+  typedef double scalar;
+  static const size_t width = 2;
+  static vec load(const double *p) { return _mm_loadu_pd(p); }
+  static void store(double *p, vec v) { _mm_storeu_pd(p, v); }
+  static vec set1(double x) { return _mm_set1_pd(x); }
+  static vec add(vec x, vec y) { return _mm_add_pd(x, y); }
+  static vec mul(vec x, vec y) { return _mm_mul_pd(x, y); }
+  static vec min(vec x, vec y) { return _mm_min_pd(x, y); }
+};
+
+struct VecFloat {
+  typedef __m128 vec;
+  typedef float scalar;
+  static const size_t width = 4;
+  static vec load(const float *p) { return _mm_loadu_ps(p); }
+  static void store(float *p, vec v) { _mm_storeu_ps(p, v); }
+  static vec set1(float x) { return _mm_set1_ps(x); }
+  static vec add(vec x, vec y) { return _mm_add_ps(x, y); }
+  static vec mul(vec x, vec y) { return _mm_mul_ps(x, y); }
+  static vec min(vec x, vec y) { return _mm_min_ps(x, y); }
+};
+
+#include "TileKernelBody.hpp"
+} // namespace tile_sse2
+#endif
+
+#ifdef MATRICES_TILE_AVX2
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace tile_avx2 {
+struct VecDouble {
+  typedef __m256d vec;
+  typedef double scalar;
+  static const size_t width = 4;
+  static vec load(const double *p) { return _mm256_loadu_pd(p); }
+  static void store(double *p, vec v) { _mm256_storeu_pd(p, v); }
+  static vec set1(double x) { return _mm256_set1_pd(x); }
+  static vec add(vec x, vec y) { return _mm256_add_pd(x, y); }
+  static vec mul(vec x, vec y) { return _mm256_mul_pd(x, y); }
+  static vec min(vec x, vec y) { return _mm256_min_pd(x, y); }
+};
+
+struct VecFloat {
+  typedef __m256 vec;
+  typedef float scalar;
+  static const size_t width = 8;
+  static vec load(const float *p) { return _mm256_loadu_ps(p); }
+  static void store(float *p, vec v) { _mm256_storeu_ps(p, v); }
+  static vec set1(float x) { return _mm256_set1_ps(x); }
+  static vec add(vec x, vec y) { return _mm256_add_ps(x, y); }
+  static vec mul(vec x, vec y) { return _mm256_mul_ps(x, y); }
+  static vec min(vec x, vec y) { return _mm256_min_ps(x, y); }
+};
+
+#include "TileKernelBody.hpp"
+} // namespace tile_avx2
+#pragma GCC pop_options
+#endif
+
+enum class TileIsa { Scalar, SSE2, AVX2 };
+
+// Detected once per process.
+inline TileIsa tileIsa() {
+  static const TileIsa isa = [] {
+#ifdef MATRICES_TILE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return TileIsa::AVX2;
+#endif
+#ifdef MATRICES_TILE_SSE2
+    return TileIsa::SSE2;
+#else
+    return TileIsa::Scalar;
+#endif
+  }();
+  return isa;
+}
+
+// Scalar C (+)= A (x) B for any semiring; C must not alias A or B.
+template <typename S, typename T>
+inline void tileScalar(T *c, size_t ldc, const T *a, size_t lda, const T *b,
+                       size_t ldb, size_t m, size_t kk, size_t nn) {
+  for (size_t i = 0; i < m; i++) {
+    T *ci = c + i * ldc;
+    for (size_t k = 0; k < kk; k++) {
+      const T aik = a[i * lda + k];
+      if (aik == S::zero())
+        continue;
+      const T *bk = b + k * ldb;
+      for (size_t j = 0; j < nn; j++)
+        ci[j] = S::add(ci[j], S::mul(aik, bk[j]));
+    }
+  }
+}
+
+template <typename S, typename Enable = void> struct TileKernel {
+  template <typename T>
+  static void run(T *c, size_t ldc, const T *a, size_t lda, const T *b,
+                  size_t ldb, size_t m, size_t kk, size_t nn) {
+    tileScalar<S>(c, ldc, a, lda, b, ldb, m, kk, nn);
+  }
+};
+
+template <typename T> struct IsSimdScalar {
+  static const bool value =
+      std::is_same<T, double>::value || std::is_same<T, float>::value;
+};
+
+template <typename T>
+struct TileKernel<MinPlus<T>,
+                  typename std::enable_if<IsSimdScalar<T>::value>::type> {
+  static void run(T *c, size_t ldc, const T *a, size_t lda, const T *b,
+                  size_t ldb, size_t m, size_t kk, size_t nn) {
+    switch (tileIsa()) {
+#ifdef MATRICES_TILE_AVX2
+    case TileIsa::AVX2:
+      tile_avx2::minPlusTile(c, ldc, a, lda, b, ldb, m, kk, nn);
+      return;
+#endif
+#ifdef MATRICES_TILE_SSE2
+    case TileIsa::SSE2:
+      tile_sse2::minPlusTile(c, ldc, a, lda, b, ldb, m, kk, nn);
+      return;
+#endif
+    default:
+      tileScalar<MinPlus<T>>(c, ldc, a, lda, b, ldb, m, kk, nn);
+    }
+  }
+};
+
+template <typename T>
+struct TileKernel<PlusTimes<T>,
+                  typename std::enable_if<IsSimdScalar<T>::value>::type> {
+  static void run(T *c, size_t ldc, const T *a, size_t lda, const T *b,
+                  size_t ldb, size_t m, size_t kk, size_t nn) {
+    switch (tileIsa()) {
+#ifdef MATRICES_TILE_AVX2
+    case TileIsa::AVX2:
+      tile_avx2::plusTimesTile(c, ldc, a, lda, b, ldb, m, kk, nn);
+      return;
+#endif
+#ifdef MATRICES_TILE_SSE2
+    case TileIsa::SSE2:
+      tile_sse2::plusTimesTile(c, ldc, a, lda, b, ldb, m, kk, nn);
+      return;
+#endif
+    default:
+      tileScalar<PlusTimes<T>>(c, ldc, a, lda, b, ldb, m, kk, nn);
+    }
+  }
+};
+
+// C (+)= A (x) B on tiles; C must not alias A or B.
+template <typename S, typename T>
+inline void tileMultiplyAdd(T *c, size_t ldc, const T *a, size_t lda,
+                            const T *b, size_t ldb, size_t m, size_t kk,
+                            size_t nn) {
+  TileKernel<S>::run(c, ldc, a, lda, b, ldb, m, kk, nn);
+}
+
+// Whole-matrix C (+)= A (x) B, cache-blocked into tile x tile pieces that
+// each go through the micro-kernel; k blocks run in order, so every entry
+// accumulates its terms in the same order as the scalar loop.
+template <typename S, typename T>
+void denseMultiplyAdd(DenseMatrix<T> &c, const DenseMatrix<T> &a,
+                      const DenseMatrix<T> &b, size_t tile = 64) {
+  size_t m = a.getNumRows(), kk = a.getNumCols(), nn = b.getNumCols();
+  if (m == 0 || kk == 0 || nn == 0)
+    return;
+  for (size_t i = 0; i < m; i += tile) {
+    for (size_t k = 0; k < kk; k += tile) {
+      for (size_t j = 0; j < nn; j += tile) {
+        tileMultiplyAdd<S>(&c(i, j), nn, &a(i, k), kk, &b(k, j), nn,
+                           std::min(tile, m - i), std::min(tile, kk - k),
+                           std::min(tile, nn - j));
+      }
+    }
+  }
+}
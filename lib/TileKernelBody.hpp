@@ -0,0 +1,119 @@
+// Register-blocked tile kernels, written once against a vector traits type
+// V (load, store, set1, add, mul, min, width). TileKernel.hpp includes this
+// file once per instruction set, inside a namespace compiled for that
+// target, so there is deliberately no include guard.
+
+// c (+)= a (x) b for (min, +)
+template <typename V> struct MinPlusStep {
+  typedef typename V::vec vec;
+  typedef typename V::scalar T;
+  static vec apply(vec c, vec a, vec b) { return V::min(V::add(a, b), c); }
+  static T apply(T c, T a, T b) { return std::min(c, T(a + b)); }
+};
+
+// c (+)= a (x) b for (+, x)
+template <typename V> struct PlusTimesStep {
+  typedef typename V::vec vec;
+  typedef typename V::scalar T;
+  static vec apply(vec c, vec a, vec b) { return V::add(c, V::mul(a, b)); }
+  static T apply(T c, T a, T b) { return c + a * b; }
+};
+
+// C (+)= A (x) B for an m x kk by kk x nn product. A 4-row by 2-vector
+// block of C stays in registers for the whole k loop; leftover rows and
+// columns take the scalar step, in the same k order. C must not alias A
+// or B.
+template <typename V, typename Step>
+inline void tileKernel(typename V::scalar *c, size_t ldc,
+                       const typename V::scalar *a, size_t lda,
+                       const typename V::scalar *b, size_t ldb, size_t m,
+                       size_t kk, size_t nn) {
+  typedef typename V::vec vec;
+  typedef typename V::scalar T;
+  const size_t W = V::width;
+
+  size_t i = 0;
+  for (; i + 4 <= m; i += 4) {
+    T *c0 = c + i * ldc, *c1 = c0 + ldc, *c2 = c1 + ldc, *c3 = c2 + ldc;
+    const T *a0 = a + i * lda, *a1 = a0 + lda, *a2 = a1 + lda, *a3 = a2 + lda;
+    size_t j = 0;
+    for (; j + 2 * W <= nn; j += 2 * W) {
+      vec r00 = V::load(c0 + j), r01 = V::load(c0 + j + W);
+      vec r10 = V::load(c1 + j), r11 = V::load(c1 + j + W);
+      vec r20 = V::load(c2 + j), r21 = V::load(c2 + j + W);
+      vec r30 = V::load(c3 + j), r31 = V::load(c3 + j + W);
+      for (size_t k = 0; k < kk; k++) {
+        const T *bk = b + k * ldb + j;
+        vec b0 = V::load(bk), b1 = V::load(bk + W);
+        vec x = V::set1(a0[k]);
+        r00 = Step::apply(r00, x, b0);
+        r01 = Step::apply(r01, x, b1);
+        x = V::set1(a1[k]);
+        r10 = Step::apply(r10, x, b0);
+        r11 = Step::apply(r11, x, b1);
+        x = V::set1(a2[k]);
+        r20 = Step::apply(r20, x, b0);
+        r21 = Step::apply(r21, x, b1);
+        x = V::set1(a3[k]);
+        r30 = Step::apply(r30, x, b0);
+        r31 = Step::apply(r31, x, b1);
+      }
+      V::store(c0 + j, r00);
+      V::store(c0 + j + W, r01);
+      V::store(c1 + j, r10);
+      V::store(c1 + j + W, r11);
+      V::store(c2 + j, r20);
+      V::store(c2 + j + W, r21);
+      V::store(c3 + j, r30);
+      V::store(c3 + j + W, r31);
+    }
+    for (; j < nn; j++) {
+      for (size_t k = 0; k < kk; k++) {
+        const T bkj = b[k * ldb + j];
+        c0[j] = Step::apply(c0[j], a0[k], bkj);
+        c1[j] = Step::apply(c1[j], a1[k], bkj);
+        c2[j] = Step::apply(c2[j], a2[k], bkj);
+        c3[j] = Step::apply(c3[j], a3[k], bkj);
+      }
+    }
+  }
+
+  for (; i < m; i++) {
+    T *ci = c + i * ldc;
+    const T *ai = a + i * lda;
+    for (size_t k = 0; k < kk; k++) {
+      const T aik = ai[k];
+      const T *bk = b + k * ldb;
+      for (size_t j = 0; j < nn; j++)
+        ci[j] = Step::apply(ci[j], aik, bk[j]);
+    }
+  }
+}
+
+inline void minPlusTile(double *c, size_t ldc, const double *a, size_t lda,
+                        const double *b, size_t ldb, size_t m, size_t kk,
+                        size_t nn) {
+  tileKernel<VecDouble, MinPlusStep<VecDouble>>(c, ldc, a, lda, b, ldb, m, kk,
+                                                nn);
+}
+
+inline void minPlusTile(float *c, size_t ldc, const float *a, size_t lda,
+                        const float *b, size_t ldb, size_t m, size_t kk,
+                        size_t nn) {
+  tileKernel<VecFloat, MinPlusStep<VecFloat>>(c, ldc, a, lda, b, ldb, m, kk,
+                                              nn);
+}
+
+inline void plusTimesTile(double *c, size_t ldc, const double *a, size_t lda,
+                          const double *b, size_t ldb, size_t m, size_t kk,
+                          size_t nn) {
+  tileKernel<VecDouble, PlusTimesStep<VecDouble>>(c, ldc, a, lda, b, ldb, m,
+                                                  kk, nn);
+}
+
+inline void plusTimesTile(float *c, size_t ldc, const float *a, size_t lda,
+                          const float *b, size_t ldb, size_t m, size_t kk,
+                          size_t nn) {
+  tileKernel<VecFloat, PlusTimesStep<VecFloat>>(c, ldc, a, lda, b, ldb, m, kk,
+                                                nn);
+}
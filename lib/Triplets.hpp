@@ -0,0 +1,96 @@
+#pragma once
+
+#include "CSRMatrix.hpp"
+#include "Instrument.hpp"
+#include "ParallelSort.hpp"
+#include "SpGEMM.hpp"
+#include "ThreadPool.hpp"
+#include <atomic>
+#include <cassert>
+#include <vector>
+
+// Bulk construction from coordinate (COO) triplets in any order.
+template <typename T> struct Triplet {
+  size_t row;
+  size_t col;
+  T value;
+};
+
+template <typename T>
+bool tripletLess(const Triplet<T> &x, const Triplet<T> &y) {
+  return x.row != y.row ? x.row < y.row : x.col < y.col;
+}
+
+// Builds an r x c CSR matrix from triplets, folding duplicate coordinates
+// with combine(x, y), e.g. min for parallel edges. The sort is not
+// stable, so combine should be associative and commutative. Entries that
+// combine to T(0) are dropped, as everywhere in sparse storage. If merged
+// is given it receives the number of triplets folded into another one.
+//
+// Sorting runs on the pool (ParallelSort.hpp); duplicates are then folded
+// in place and the arrays filled row by row in parallel, so past the sort
+// every triplet is read twice and every output entry written once.
+template <typename T, typename Combine>
+CSRMatrix<T> csrFromTriplets(size_t r, size_t c,
+                             std::vector<Triplet<T>> triplets, Combine combine,
+                             thread_pool *pool = nullptr,
+                             size_t *merged = nullptr) {
+  MATRICES_PHASE("triplets.build");
+  parallelSort(triplets, tripletLess<T>, pool);
+  size_t m = triplets.size();
+  assert(m == 0 || (triplets[m - 1].row < r));
+
+  // rowStart[i] is the first triplet of row i; every boundary between two
+  // rows fills the starts of the (possibly empty) rows in between
+  std::vector<size_t> rowStart(r + 1, m);
+  forEachRange(pool, m, [&](size_t begin, size_t end) {
+    for (size_t p = begin; p < end; p++) {
+      assert(triplets[p].col < c);
+      size_t first = p == 0 ? 0 : triplets[p - 1].row + 1;
+      for (size_t i = first; i <= triplets[p].row; i++)
+        rowStart[i] = p;
+    }
+  });
+
+  // fold each row's duplicates into the front of its own range
+  std::vector<size_t> ptr(r + 1, 0);
+  std::atomic<size_t> folded(0);
+  forEachRange(pool, r, [&](size_t begin, size_t end) {
+    size_t rangeFolded = 0;
+    for (size_t i = begin; i < end; i++) {
+      size_t out = rowStart[i];
+      for (size_t p = rowStart[i]; p < rowStart[i + 1];) {
+        Triplet<T> t = triplets[p++];
+        while (p < rowStart[i + 1] && triplets[p].col == t.col) {
+          t.value = combine(t.value, triplets[p++].value);
+          rangeFolded++;
+        }
+        if (t.value != T(0))
+          triplets[out++] = t;
+      }
+      ptr[i + 1] = out - rowStart[i];
+    }
+    folded += rangeFolded;
+  });
+
+  size_t kept = 0;
+  for (size_t i = 0; i < r; i++) {
+    kept += ptr[i + 1];
+    ptr[i + 1] = kept;
+  }
+  if (merged)
+    *merged = folded;
+
+  std::vector<size_t> idx(kept);
+  std::vector<T> val(kept);
+  forEachRange(pool, r, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      for (size_t p = ptr[i]; p < ptr[i + 1]; p++) {
+        const Triplet<T> &t = triplets[rowStart[i] + p - ptr[i]];
+        idx[p] = t.col;
+        val[p] = t.value;
+      }
+    }
+  });
+  return CSRMatrix<T>(r, c, std::move(ptr), std::move(idx), std::move(val));
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <mutex>
+
+// A pool task and the batch it belongs to: the parallel_for call that split
+// it off, or nullptr for a task given to submit().
+struct pool_task {
+  std::function<void()> run;
+  const void *batch;
+};
+
+// Per-worker task deque. The owning thread pushes and pops at the front,
+// so it keeps working on the most recently split (cache-hot) range; other
+// workers steal from the back, which holds the oldest and largest pieces.
+class work_stealing_queue {
+private:
+  typedef pool_task data_type;
+  std::deque<data_type> the_queue;
+  mutable std::mutex the_mutex;
+
+public:
+  work_stealing_queue() {}
+
+  work_stealing_queue(const work_stealing_queue &other) = delete;
+  work_stealing_queue &operator=(const work_stealing_queue &other) = delete;
+
+  void push(data_type data) {
+    std::lock_guard<std::mutex> lock(the_mutex);
+    the_queue.push_front(std::move(data));
+  }
+
+  bool empty() const {
+    std::lock_guard<std::mutex> lock(the_mutex);
+    return the_queue.empty();
+  }
+
+  bool try_pop(data_type &res) {
+    std::lock_guard<std::mutex> lock(the_mutex);
+    if (the_queue.empty())
+      return false;
+    res = std::move(the_queue.front());
+    the_queue.pop_front();
+    return true;
+  }
+
+  bool try_steal(data_type &res) {
+    std::lock_guard<std::mutex> lock(the_mutex);
+    if (the_queue.empty())
+      return false;
+    res = std::move(the_queue.back());
+    the_queue.pop_back();
+    return true;
+  }
+
+  // Takes the oldest task of the given batch, wherever it sits; for a
+  // thread that waits for that batch and must not run anything else.
+  bool try_take(data_type &res, const void *batch) {
+    std::lock_guard<std::mutex> lock(the_mutex);
+    for (auto it = the_queue.rbegin(); it != the_queue.rend(); ++it) {
+      if (it->batch == batch) {
+        res = std::move(*it);
+        the_queue.erase(std::next(it).base());
+        return true;
+      }
+    }
+    return false;
+  }
+};
@@ -0,0 +1,115 @@
+#include "../lib/BoundedClosure.hpp"
+#include "../lib/Closure.hpp"
+#include "Check.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+// boundedClosure against the rows of squaringClosure: within(r) keeps
+// exactly the entries at distance r or less, nearest(k) keeps min(k, reach)
+// entries with the k best values, ties included, and (i, i) only through
+// a cycle.
+
+// row i of m as (value, column) pairs, best first
+template <typename T>
+static std::vector<std::pair<T, size_t>> sortedRow(const CSRMatrix<T> &m,
+                                                   size_t i) {
+  std::vector<std::pair<T, size_t>> r;
+  for (size_t p = m.rowBegin(i); p < m.rowEnd(i); p++)
+    r.push_back(std::make_pair(m.value(p), m.col(p)));
+  std::sort(r.begin(), r.end());
+  return r;
+}
+
+static bool close(double x, double y) {
+  return std::fabs(x - y) <= 1e-9 * std::max(std::fabs(x), std::fabs(y));
+}
+
+// nearest(k) of full, row by row: the kept values are the k best ones
+// (compared as values, so any choice among ties passes) at the right
+// columns
+template <typename T>
+static bool nearestHolds(const CSRMatrix<T> &bounded, const CSRMatrix<T> &full,
+                         size_t k) {
+  for (size_t i = 0; i < full.getNumRows(); i++) {
+    std::vector<std::pair<T, size_t>> got = sortedRow(bounded, i),
+                                      all = sortedRow(full, i);
+    if (got.size() != std::min(k, all.size()))
+      return false;
+    for (size_t q = 0; q < got.size(); q++) {
+      size_t p = full.rowBegin(i);
+      while (p < full.rowEnd(i) && full.col(p) != got[q].second)
+        p++;
+      if (p == full.rowEnd(i) || !close(full.value(p), got[q].first) ||
+          !close(all[q].first, got[q].first))
+        return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  std::mt19937 rng(8);
+  thread_pool pool(3);
+  typedef MinPlus<double> S;
+
+  SparseMatrix<double> g = randomGraph(150, 450, rng);
+  CSRMatrix<double> a = g.toCSR();
+  CSRMatrix<double> full = squaringClosure<S>(a);
+  for (int usePool = 0; usePool < 2; usePool++) {
+    thread_pool *p = usePool ? &pool : nullptr;
+    for (double r : {0.05, 2.7, 8.31, 19.4, 1e9}) {
+      SparseMatrix<double> expected(150, 150);
+      for (size_t i = 0; i < 150; i++) {
+        for (size_t q = full.rowBegin(i); q < full.rowEnd(i); q++) {
+          if (full.value(q) <= r)
+            expected.set(full.value(q), i, full.col(q));
+        }
+      }
+      CHECK(sameEntries(
+          boundedClosure<S>(a, SearchBounds<double>::within(r), p), expected));
+    }
+    for (size_t k : {0, 1, 3, 10, 1000})
+      CHECK(nearestHolds(
+          boundedClosure<S>(a, SearchBounds<double>::nearest(k), p), full, k));
+  }
+  CHECK(sameEntries(g.diamondNearest(4, &pool),
+                    boundedClosure<S>(a, SearchBounds<double>::nearest(4))));
+
+  // unit weights: nearly every k-th value is tied with others
+  SparseMatrix<int> unit(100, 100);
+  for (size_t k = 0; k < 300; k++)
+    unit.set(1, rng() % 100, rng() % 100);
+  CSRMatrix<int> u = unit.toCSR(), uFull = squaringClosure<MinPlus<int>>(u);
+  for (size_t k : {1, 2, 5, 17}) {
+    CHECK(nearestHolds(boundedClosure<MinPlus<int>>(
+                           u, SearchBounds<int>::nearest(k), &pool),
+                       uFull, k));
+  }
+
+  // (i, i) only through the cycle 0 -> 1 -> 0; 2 reaches nothing
+  SparseMatrix<int> cyc(3, 3);
+  cyc.set(1, 0, 1);
+  cyc.set(1, 1, 0);
+  cyc.set(5, 1, 2);
+  SparseMatrix<int> two(boundedClosure<MinPlus<int>>(
+      cyc.toCSR(), SearchBounds<int>::nearest(2)));
+  CHECK(two.get(0, 1) == 1 && two.get(0, 0) == 2 && two.get(0, 2) == 0);
+  CHECK(two.get(1, 0) == 1 && two.get(1, 1) == 2 && two.get(1, 2) == 0);
+  CHECK(two.get(2, 0) == 0 && two.get(2, 1) == 0 && two.get(2, 2) == 0);
+  SparseMatrix<int> near(boundedClosure<MinPlus<int>>(
+      cyc.toCSR(), SearchBounds<int>::within(1)));
+  CHECK(near.get(0, 1) == 1 && near.get(1, 0) == 1 && near.get(0, 0) == 0 &&
+        near.toCSR().nnz() == 2);
+
+  bool negative = false;
+  cyc.set(-1, 2, 0);
+  try {
+    boundedClosure<MinPlus<int>>(cyc.toCSR(), SearchBounds<int>::within(3));
+  } catch (const std::domain_error &) {
+    negative = true;
+  }
+  CHECK(negative);
+
+  return checkResult("BoundedClosureTest");
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "../lib/CSRMatrix.hpp"
+#include "../lib/SparseMatrix.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+// Minimal harness for the programs in tests/: each one is a single
+// executable that reports failed checks and exits nonzero if there were
+// any. "make check" builds and runs all of them.
+
+static int checkFailures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed"  \
+                << std::endl;                                                  \
+      checkFailures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+inline int checkResult(const char *name) {
+  if (checkFailures)
+    std::cerr << name << ": " << checkFailures << " failed checks" << std::endl;
+  else
+    std::cout << name << ": ok" << std::endl;
+  return checkFailures ? 1 : 0;
+}
+
+// n vertices and about arcs random arcs with weights in [0.1, 10) that
+// are rarely integers, so that sums depend on the order they are taken in.
+inline SparseMatrix<double> randomGraph(size_t n, size_t arcs,
+                                        std::mt19937 &rng) {
+  SparseMatrix<double> a(n, n);
+  std::uniform_real_distribution<double> weight(0.1, 10.0);
+  for (size_t k = 0; k < arcs; k++)
+    a.set(weight(rng), rng() % n, rng() % n);
+  return a;
+}
+
+// x == y up to a relative error of tol on every value; engines that sum
+// paths in a different order may differ in the last bits.
+template <typename X, typename Y>
+bool sameEntries(const X &x, const Y &y, double tol = 1e-9) {
+  if (x.getNumRows() != y.getNumRows() || x.getNumCols() != y.getNumCols())
+    return false;
+  for (size_t i = 0; i < x.getNumRows(); i++) {
+    for (size_t j = 0; j < x.getNumCols(); j++) {
+      double u = x.get(i, j), v = y.get(i, j);
+      if ((u == 0) != (v == 0) ||
+          std::fabs(u - v) > tol * std::max(std::fabs(u), std::fabs(v)))
+        return false;
+    }
+  }
+  return true;
+}
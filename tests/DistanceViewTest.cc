@@ -0,0 +1,98 @@
+#include "../lib/Closure.hpp"
+#include "../lib/DistanceView.hpp"
+#include "Check.hpp"
+#include <thread>
+#include <vector>
+
+// DistanceView rows against squaringClosure, by Dijkstra and by semi-naive
+// relaxation, under a cache budget small enough to evict, and from several
+// threads sharing one pool.
+
+template <typename S, typename M>
+static bool sameRow(const typename DistanceView<S>::RowPtr &row,
+                    const M &closure, size_t i) {
+  SparseMatrix<double> r(1, closure.getNumCols()), c(1, closure.getNumCols());
+  for (size_t k = 0; k < row->nnz(); k++)
+    r.set(row->vals[k], 0, row->cols[k]);
+  for (size_t j = 0; j < closure.getNumCols(); j++) {
+    c.set(closure.get(i, j), 0, j);
+    if (row->get(j) != r.get(0, j))
+      return false;
+  }
+  return sameEntries(r, c);
+}
+
+int main() {
+  std::mt19937 rng(6);
+  thread_pool pool(3);
+  typedef MinPlus<double> S;
+
+  // fractional weights: Dijkstra rows
+  SparseMatrix<double> g = randomGraph(200, 700, rng);
+  CSRMatrix<double> closure = squaringClosure<S>(g.toCSR());
+  DistanceView<S> view(g, 20 * 200 * sizeof(double));
+  std::vector<size_t> sources;
+  for (size_t k = 0; k < 60; k++)
+    sources.push_back(rng() % 200);
+  for (size_t i : sources)
+    CHECK(sameRow<S>(view.row(i), closure, i));
+  CHECK(view.get(sources[0], sources[1]) ==
+        view.row(sources[0])->get(sources[1]));
+  std::vector<DistanceView<S>::RowPtr> rows = view.rows(sources, &pool);
+  CHECK(rows.size() == sources.size());
+  for (size_t k = 0; k < sources.size(); k++)
+    CHECK(sameRow<S>(rows[k], closure, sources[k]));
+  DistanceCacheStats st = view.cacheStats();
+  CHECK(st.evictions > 0 && st.bytes <= view.cacheBudget());
+  CHECK(st.hits > 0 && st.misses > 0);
+
+  // two threads asking for overlapping batches on one pool, and a third
+  // asking row by row, all of them mostly missing
+  view.clear();
+  std::vector<char> ok(3, 1);
+  std::vector<std::thread> callers;
+  for (size_t t = 0; t < ok.size(); t++) {
+    callers.emplace_back([&, t] {
+      std::mt19937 r(t);
+      for (int round = 0; round < 20; round++) {
+        std::vector<size_t> batch;
+        for (size_t k = 0; k < 30; k++)
+          batch.push_back(r() % 200);
+        if (t == 2) {
+          for (size_t i : batch)
+            ok[t] = ok[t] && sameRow<S>(view.row(i), closure, i);
+          continue;
+        }
+        std::vector<DistanceView<S>::RowPtr> got = view.rows(batch, &pool);
+        for (size_t k = 0; k < batch.size(); k++)
+          ok[t] = ok[t] && sameRow<S>(got[k], closure, batch[k]);
+      }
+    });
+  }
+  for (auto &c : callers)
+    c.join();
+  for (char o : ok)
+    CHECK(o);
+
+  // negative weights on a DAG: semi-naive rows, no cache at all
+  SparseMatrix<double> dag(80, 80);
+  std::uniform_real_distribution<double> weight(-5.0, 5.0);
+  for (size_t k = 0; k < 300; k++) {
+    size_t u = rng() % 80, v = rng() % 80;
+    if (u != v)
+      dag.set(weight(rng), std::min(u, v), std::max(u, v));
+  }
+  CSRMatrix<double> dagClosure = squaringClosure<S>(dag.toCSR());
+  DistanceView<S> negative(dag, 0);
+  std::vector<size_t> all;
+  for (size_t i = 0; i < 80; i++)
+    all.push_back(i);
+  rows = negative.rows(all, &pool);
+  for (size_t i = 0; i < 80; i++) {
+    CHECK(sameRow<S>(rows[i], dagClosure, i));
+    CHECK(sameRow<S>(negative.row(i), dagClosure, i));
+  }
+  CHECK(negative.cacheStats().rows == 0 && negative.cacheStats().hits == 0);
+
+  return checkResult("DistanceViewTest");
+}
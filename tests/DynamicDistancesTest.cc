@@ -0,0 +1,79 @@
+#include "../lib/Closure.hpp"
+#include "../lib/Dijkstra.hpp"
+#include "../lib/DynamicDistances.hpp"
+#include "Check.hpp"
+#include <stdexcept>
+#include <vector>
+
+// DynamicDistances::apply against a fresh dijkstraClosure after every batch
+// of random updates with fractional weights, seeded both from the squaring
+// engine and from its own Dijkstra searches.
+
+typedef MinPlus<double> S;
+
+static std::vector<ArcUpdate<double>> randomBatch(SparseMatrix<double> &arcs,
+                                                  int kind, std::mt19937 &rng) {
+  size_t n = arcs.getNumRows();
+  std::uniform_real_distribution<double> weight(0.1, 10.0);
+  std::vector<ArcUpdate<double>> batch;
+  for (size_t k = 1 + rng() % 6; k > 0; k--) {
+    size_t u = rng() % n, v = rng() % n;
+    double old = arcs.get(u, v), w;
+    if (kind == 0) // increases, or a new arc if there was none
+      w = old + weight(rng);
+    else if (kind == 1) // deletions
+      w = 0;
+    else
+      w = rng() % 4 == 0 ? 0 : weight(rng);
+    batch.push_back(ArcUpdate<double>{u, v, w});
+    arcs.set(w, u, v);
+  }
+  return batch;
+}
+
+int main() {
+  std::mt19937 rng(5);
+  thread_pool pool(3);
+
+  for (int trial = 0; trial < 60; trial++) {
+    size_t n = 4 + rng() % 12;
+    SparseMatrix<double> arcs = randomGraph(n, 3 * n, rng);
+    thread_pool *p = trial % 2 ? &pool : nullptr;
+    DynamicDistances<S> seeded(
+        arcs, SparseMatrix<double>(squaringClosure<S>(arcs.toCSR())));
+    DynamicDistances<S> own(arcs, p);
+    for (int round = 0; round < 15; round++) {
+      std::vector<ArcUpdate<double>> batch = randomBatch(arcs, round % 3, rng);
+      seeded.apply(batch, p);
+      own.apply(batch, p);
+      CSRMatrix<double> expected = dijkstraClosure<S>(arcs.toCSR());
+      CHECK(sameEntries(seeded.distances(), expected));
+      CHECK(sameEntries(own.distances(), expected));
+      CHECK(sameEntries(own.arcs(), arcs, 0));
+    }
+  }
+
+  // exact weights: ties are real, and the last of several updates wins
+  SparseMatrix<int> g(4, 4);
+  g.set(1, 0, 1);
+  g.set(1, 1, 2);
+  g.set(2, 0, 2);
+  g.set(1, 2, 3);
+  DynamicDistances<MinPlus<int>> dd(g);
+  CHECK(dd.get(0, 3) == 3);
+  dd.apply({{0, 2, 5}, {1, 2, 0}, {0, 2, 4}});
+  CHECK(dd.get(0, 2) == 4 && dd.get(0, 3) == 5 && dd.get(1, 3) == 0);
+  CHECK(dd.stats().updates == 3 && dd.stats().rowsRecomputed > 0);
+  dd.set(1, 3, 0);
+  CHECK(dd.get(0, 0) == 6 && dd.get(3, 3) == 6 && dd.get(1, 0) == 0);
+
+  bool negative = false;
+  try {
+    dd.set(-1, 2, 1);
+  } catch (const std::domain_error &) {
+    negative = true;
+  }
+  CHECK(negative && dd.arcs().get(2, 1) == 0 && dd.get(2, 1) == 3);
+
+  return checkResult("DynamicDistancesTest");
+}
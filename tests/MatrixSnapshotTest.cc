@@ -0,0 +1,114 @@
+#include "../lib/MatrixSnapshot.hpp"
+#include "Check.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+// saveSnapshot / loadSnapshot round trips and the checks on bad files.
+
+static std::string tempPath(const char *name) {
+  return std::string(P_tmpdir) + "/" + name + "-" + std::to_string(getpid()) +
+         ".snap";
+}
+
+template <typename T>
+static bool throwsOnLoad(const std::string &path, bool checkColumns = false) {
+  try {
+    loadSnapshot<T>(path, checkColumns);
+  } catch (const std::runtime_error &) {
+    return true;
+  }
+  return false;
+}
+
+// overwrites the 8 bytes at offset of path with value
+static void patch(const std::string &path, size_t offset, uint64_t value) {
+  std::FILE *f = std::fopen(path.c_str(), "r+b");
+  std::fseek(f, long(offset), SEEK_SET);
+  std::fwrite(&value, sizeof(value), 1, f);
+  std::fclose(f);
+}
+
+int main() {
+  std::mt19937 rng(2);
+  std::string path = tempPath("MatrixSnapshotTest");
+
+  SparseMatrix<double> m = randomGraph(200, 900, rng);
+  m.set(1.5, 199, 0); // last row not empty
+  saveSnapshot(m, path);
+  CHECK(isSnapshot(path));
+  {
+    CSRMatrix<double> back = loadSnapshot<double>(path);
+    CHECK(back.nnz() == m.toCSR().nnz());
+    CHECK(sameEntries(back, m, 0));
+  }
+  CHECK(throwsOnLoad<float>(path));
+  CHECK(throwsOnLoad<int64_t>(path));
+
+  // an odd count of 2-byte values needs padding at the end of the file
+  SparseMatrix<uint16_t> small(5, 7);
+  small.set(3, 0, 6);
+  small.set(65535, 4, 0);
+  small.set(9, 2, 2);
+  saveSnapshot(small, path);
+  {
+    CSRMatrix<uint16_t> back = loadSnapshot<uint16_t>(path);
+    CHECK(back.getNumRows() == 5 && back.getNumCols() == 7);
+    CHECK(sameEntries(back, small, 0));
+  }
+  CHECK(throwsOnLoad<int16_t>(path));
+
+  SparseMatrix<double> empty(4, 4);
+  saveSnapshot(empty, path);
+  CHECK(loadSnapshot<double>(path).nnz() == 0);
+
+  // header counts that would wrap the array sizes, or that do not fit the
+  // file or the shape
+  const uint64_t wrapping[] = {(uint64_t(1) << 61) + 3, uint64_t(-1),
+                               uint64_t(1) << 62, 100000};
+  for (size_t field :
+       {offsetof(SnapshotHeader, rows), offsetof(SnapshotHeader, nnz)}) {
+    for (uint64_t bad : wrapping) {
+      saveSnapshot(small, path);
+      patch(path, field, bad);
+      CHECK(throwsOnLoad<uint16_t>(path));
+    }
+  }
+  saveSnapshot(m, path);
+  patch(path, offsetof(SnapshotHeader, cols), 1);
+  CHECK(throwsOnLoad<double>(path));
+  saveSnapshot(m, path);
+  patch(path, offsetof(SnapshotHeader, cols), 0);
+  CHECK(throwsOnLoad<double>(path));
+
+  // column indices are only read when asked to: out of range, and out of
+  // order within a row
+  saveSnapshot(small, path);
+  CHECK(!throwsOnLoad<uint16_t>(path, true));
+  size_t idx = sizeof(SnapshotHeader) + 6 * sizeof(size_t);
+  patch(path, idx, 7);
+  CHECK(!throwsOnLoad<uint16_t>(path));
+  CHECK(throwsOnLoad<uint16_t>(path, true));
+  SparseMatrix<uint16_t> row(1, 9);
+  row.set(1, 0, 2);
+  row.set(1, 0, 5);
+  saveSnapshot(row, path);
+  patch(path, sizeof(SnapshotHeader) + 2 * sizeof(size_t), 6);
+  CHECK(throwsOnLoad<uint16_t>(path, true));
+
+  // truncated file and wrong magic
+  saveSnapshot(m, path);
+  CHECK(truncate(path.c_str(), 64 + 8 * 100) == 0);
+  CHECK(throwsOnLoad<double>(path));
+  std::FILE *f = std::fopen(path.c_str(), "wb");
+  std::fputs("c not a snapshot\n", f);
+  std::fclose(f);
+  CHECK(!isSnapshot(path));
+  CHECK(throwsOnLoad<double>(path));
+
+  std::remove(path.c_str());
+  return checkResult("MatrixSnapshotTest");
+}
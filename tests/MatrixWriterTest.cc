@@ -0,0 +1,83 @@
+#include "../lib/DimacsLoader.hpp"
+#include "../lib/MatrixWriter.hpp"
+#include "Check.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// writeDimacs round trips through loadDimacsCSR, on and off the pool, from
+// several threads and from inside a pool task, and a failed write throws
+// without leaving the pool busy.
+
+static std::string tempPath(const char *name, size_t k) {
+  return std::string(P_tmpdir) + "/" + name + "-" + std::to_string(getpid()) +
+         "-" + std::to_string(k) + ".txt";
+}
+
+int main() {
+  std::mt19937 rng(9);
+  thread_pool pool(3);
+
+  // enough entries for several blocks per batch
+  SparseMatrix<double> m = randomGraph(3000, 400000, rng);
+  m.set(2, 2999, 0);
+  m.set(-7, 5, 6);
+  CSRMatrix<double> a = m.toCSR();
+
+  std::string path = tempPath("MatrixWriterTest", 0);
+  for (int usePool = 0; usePool < 2; usePool++) {
+    writeDimacs(a, path, usePool ? &pool : nullptr);
+    CHECK(sameEntries(loadDimacsCSR<double>(path, pool), a, 0));
+  }
+
+  // two outside threads and a pool task write at once
+  std::vector<char> ok(3, 0);
+  std::vector<std::thread> writers;
+  for (size_t t = 0; t < 2; t++) {
+    writers.emplace_back([&, t] {
+      std::string p = tempPath("MatrixWriterTest", t + 1);
+      writeDimacs(a, p, &pool);
+      ok[t] = sameEntries(loadDimacsCSR<double>(p, pool), a, 0);
+      std::remove(p.c_str());
+    });
+  }
+  // not pool.wait(), which could run the task on this thread
+  std::atomic<bool> inWorker(false), finished(false);
+  pool.submit([&] {
+    inWorker = pool.current_worker() < pool.size();
+    std::string p = tempPath("MatrixWriterTest", 3);
+    writeDimacs(a, p, &pool);
+    ok[2] = sameEntries(loadDimacsCSR<double>(p, pool), a, 0);
+    std::remove(p.c_str());
+    finished = true;
+  });
+  while (!finished)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  for (auto &w : writers)
+    w.join();
+  CHECK(inWorker);
+  for (char o : ok)
+    CHECK(o);
+
+  // a full device fails the writes; the error comes back to the caller
+  // and the pool still takes new work
+  if (access("/dev/full", W_OK) == 0) {
+    bool failed = false;
+    try {
+      writeDimacs(a, "/dev/full", &pool);
+    } catch (const std::runtime_error &) {
+      failed = true;
+    }
+    CHECK(failed);
+    writeDimacs(a, path, &pool);
+    CHECK(sameEntries(loadDimacsCSR<double>(path, pool), a, 0));
+  }
+
+  std::remove(path.c_str());
+  return checkResult("MatrixWriterTest");
+}
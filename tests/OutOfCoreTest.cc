@@ -0,0 +1,117 @@
+#include "../lib/Closure.hpp"
+#include "../lib/OutOfCore.hpp"
+#include "../lib/RowBlockFile.hpp"
+#include "Check.hpp"
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+// RowBlockFile spill and reload, and the out-of-core closure under a block
+// budget that forces many blocks.
+
+static std::string tempPath(const char *name) {
+  return std::string(P_tmpdir) + "/" + name + "-" + std::to_string(getpid()) +
+         ".rows";
+}
+
+int main() {
+  std::mt19937 rng(3);
+  std::string path = tempPath("OutOfCoreTest");
+
+  // uneven blocks of a random float matrix, some rows empty
+  {
+    SparseMatrix<float> s(50, 80);
+    for (size_t k = 0; k < 400; k++)
+      s.set(float(rng() % 1000) / 8 + 0.5f, rng() % 50, rng() % 80);
+    for (size_t j = 0; j < 80; j++) {
+      s.set(0, 0, j);
+      s.set(0, 30, j);
+    }
+    CSRMatrix<float> m = s.toCSR();
+    std::vector<std::vector<uint32_t>> cols(50);
+    std::vector<std::vector<float>> vals(50);
+    for (size_t i = 0; i < 50; i++) {
+      for (size_t p = m.rowBegin(i); p < m.rowEnd(i); p++) {
+        cols[i].push_back(uint32_t(m.col(p)));
+        vals[i].push_back(m.value(p));
+      }
+    }
+    RowBlockWriter<float> writer(path, 50, 80);
+    size_t sizes[] = {1, 7, 20, 22};
+    size_t row = 0;
+    for (size_t count : sizes) {
+      writer.writeBlock(row, count, cols, vals);
+      row += count;
+    }
+    bool outOfOrder = false;
+    try {
+      writer.writeBlock(0, 1, cols, vals);
+    } catch (const std::logic_error &) {
+      outOfOrder = true;
+    }
+    CHECK(outOfOrder);
+    writer.close();
+
+    RowBlockReader<float> counter(path);
+    CHECK(counter.countNonZeros() == m.nnz());
+    CHECK(sameEntries(counter.readAll(), s, 0));
+
+    RowBlockReader<float> reader(path);
+    size_t first, blocks = 0, seen = 0;
+    CSRMatrix<float> block;
+    while (reader.next(first, block)) {
+      CHECK(first == seen);
+      for (size_t i = 0; i < block.getNumRows(); i++) {
+        for (size_t p = block.rowBegin(i); p < block.rowEnd(i); p++)
+          CHECK(block.value(p) == s.get(first + i, block.col(p)));
+        CHECK(block.rowSize(i) == m.rowSize(first + i));
+      }
+      seen += block.getNumRows();
+      blocks++;
+    }
+    CHECK(blocks == 4 && seen == 50);
+
+    bool wrongType = false;
+    try {
+      RowBlockReader<double> r(path);
+    } catch (const std::runtime_error &) {
+      wrongType = true;
+    }
+    CHECK(wrongType);
+  }
+
+  // closure spilled in blocks of a few rows each, on and off the pool
+  thread_pool pool(3);
+  SparseMatrix<double> g = randomGraph(300, 900, rng);
+  CSRMatrix<double> a = g.toCSR();
+  CSRMatrix<double> expected = squaringClosure<MinPlus<double>>(a);
+  size_t rowMax = 300 * (sizeof(uint32_t) + sizeof(double));
+  for (int usePool = 0; usePool < 2; usePool++) {
+    thread_pool *p = usePool ? &pool : nullptr;
+    OutOfCoreStats big =
+        outOfCoreClosure<MinPlus<double>>(a, path, size_t(1) << 30, p);
+    CHECK(big.blocks == 1);
+    for (size_t rows : {1, 5, 40}) {
+      size_t budget = big.fixedBytes + rows * rowMax;
+      OutOfCoreStats st = outOfCoreClosure<MinPlus<double>>(a, path, budget, p);
+      CHECK(st.blockBudget == rows * rowMax);
+      CHECK(st.peakBlockBytes <= st.blockBudget);
+      CHECK(st.blocks > 1);
+      CHECK(st.nnz == expected.nnz());
+      RowBlockReader<double> r(path);
+      CHECK(sameEntries(r.readAll(), expected));
+    }
+    bool tooSmall = false;
+    try {
+      outOfCoreClosure<MinPlus<double>>(a, path, big.fixedBytes + rowMax - 1,
+                                        p);
+    } catch (const std::runtime_error &) {
+      tooSmall = true;
+    }
+    CHECK(tooSmall);
+  }
+
+  std::remove(path.c_str());
+  return checkResult("OutOfCoreTest");
+}
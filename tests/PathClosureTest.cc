@@ -0,0 +1,104 @@
+#include "../lib/Closure.hpp"
+#include "../lib/PathClosure.hpp"
+#include "Check.hpp"
+#include <stdexcept>
+#include <vector>
+
+// pathClosure distances against squaringClosure, and every recorded path
+// walked back over the arcs: it must run from i to j and its weights must
+// combine to the distance. Dijkstra on fractional min-plus weights and on
+// max-min bottlenecks full of ties, semi-naive on negative weights.
+
+// true when every path of p is consistent with the arcs of g
+template <typename S>
+static bool pathsHold(const PathClosure<typename S::value_type> &p,
+                      const SparseMatrix<typename S::value_type> &g) {
+  typedef typename S::value_type T;
+  size_t n = g.getNumRows();
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < n; j++) {
+      std::vector<size_t> route = p.path(i, j);
+      if (p.get(i, j) == T(0)) {
+        if (!route.empty())
+          return false;
+        continue;
+      }
+      if (route.size() < 2 || route.size() > n + 1 || route.front() != i ||
+          route.back() != j || p.predecessor(i, j) != route[route.size() - 2])
+        return false;
+      T total = g.get(route[0], route[1]);
+      for (size_t k = 1; k + 1 < route.size(); k++) {
+        T w = g.get(route[k], route[k + 1]);
+        if (w == T(0))
+          return false;
+        total = S::mul(total, w);
+      }
+      SparseMatrix<T> x(1, 1), y(1, 1);
+      x.set(total, 0, 0);
+      y.set(p.get(i, j), 0, 0);
+      if (total == T(0) || !sameEntries(x, y))
+        return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  std::mt19937 rng(7);
+  thread_pool pool(3);
+
+  // fractional min-plus weights, on and off the pool
+  SparseMatrix<double> g = randomGraph(120, 400, rng);
+  CSRMatrix<double> expected = squaringClosure<MinPlus<double>>(g.toCSR());
+  for (int usePool = 0; usePool < 2; usePool++) {
+    PathClosure<double> p =
+        pathClosure<MinPlus<double>>(g.toCSR(), usePool ? &pool : nullptr);
+    CHECK(sameEntries(p.dist, expected));
+    CHECK(p.pred.size() == p.nnz());
+    CHECK(pathsHold<MinPlus<double>>(p, g));
+  }
+  CHECK(sameEntries(g.diamondPaths(&pool).dist, expected));
+
+  // max-min with few distinct capacities: bottlenecks tie everywhere, and
+  // the routes must still end at their source
+  SparseMatrix<int> cap(60, 60);
+  for (size_t k = 0; k < 300; k++)
+    cap.set(1 + rng() % 3, rng() % 60, rng() % 60);
+  PathClosure<int> widest = cap.closurePaths<MaxMin<int>>(&pool);
+  CHECK(sameEntries(widest.dist, squaringClosure<MaxMin<int>>(cap.toCSR()),
+                    0));
+  CHECK(pathsHold<MaxMin<int>>(widest, cap));
+
+  // strictly negative weights on a DAG: semi-naive rows, no prefix sums
+  // to T(0)
+  SparseMatrix<double> dag(80, 80);
+  std::uniform_real_distribution<double> weight(-5.0, -0.1);
+  for (size_t k = 0; k < 300; k++) {
+    size_t u = rng() % 80, v = rng() % 80;
+    if (u != v)
+      dag.set(weight(rng), std::min(u, v), std::max(u, v));
+  }
+  PathClosure<double> negative =
+      pathClosure<MinPlus<double>>(dag.toCSR(), &pool);
+  CHECK(sameEntries(negative.dist,
+                    squaringClosure<MinPlus<double>>(dag.toCSR())));
+  CHECK(pathsHold<MinPlus<double>>(negative, dag));
+
+  // a prefix summing to T(0) drops its entry, and the walk back throws
+  SparseMatrix<double> zero(4, 4);
+  zero.set(-1, 0, 1);
+  zero.set(1, 1, 2);
+  zero.set(2, 2, 3);
+  PathClosure<double> z = pathClosure<MinPlus<double>>(zero.toCSR());
+  CHECK(z.get(0, 2) == 0 && z.get(0, 3) == 2);
+  bool unreachable = false;
+  try {
+    z.path(0, 3);
+  } catch (const std::runtime_error &) {
+    unreachable = true;
+  }
+  CHECK(unreachable);
+  CHECK(z.path(3, 0).empty() && z.path(1, 3).size() == 3);
+
+  return checkResult("PathClosureTest");
+}
@@ -0,0 +1,73 @@
+#include "../lib/SpGEMM.hpp"
+#include "../lib/ThreadPool.hpp"
+#include "Check.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Several threads outside the pool, and calls nested inside tasks, share
+// one pool: per-call scratch indexed by workerSlot() must never be used by
+// two pieces at once.
+
+// One parallel_for whose pieces claim their slot and hold it for a moment;
+// returns the number of pieces that found their slot already taken.
+static size_t claimSlots(thread_pool &pool, size_t n, bool nest) {
+  std::vector<std::atomic<int>> busy(workerSlots(&pool));
+  for (auto &b : busy)
+    b = 0;
+  std::atomic<size_t> clashes(0);
+  forEachRange(&pool, n, [&](size_t begin, size_t end) {
+    std::atomic<int> &slot = busy[workerSlot(&pool)];
+    if (slot.exchange(1))
+      clashes++;
+    for (size_t i = begin; i < end; i++) {
+      if (nest)
+        clashes += claimSlots(pool, 16, false);
+      else
+        std::this_thread::yield();
+    }
+    slot = 0;
+  });
+  return clashes;
+}
+
+int main() {
+  thread_pool pool(3);
+
+  std::vector<size_t> clashes(4, 0);
+  std::vector<std::thread> callers;
+  for (size_t t = 0; t < clashes.size(); t++) {
+    callers.emplace_back([&pool, &clashes, t] {
+      for (int round = 0; round < 50; round++)
+        clashes[t] += claimSlots(pool, 64, round % 2 == 1);
+    });
+  }
+  for (auto &c : callers)
+    c.join();
+  for (size_t c : clashes)
+    CHECK(c == 0);
+
+  // the SpGEMM and closure kernels keep per-worker scratch the same way
+  std::mt19937 rng(1);
+  SparseMatrix<double> m = randomGraph(300, 1200, rng);
+  SparseMatrix<double> product = m.multiply<PlusTimes<double>>(m);
+  SparseMatrix<double> closure = m.diamond();
+  std::vector<char> same(4, 0);
+  callers.clear();
+  for (size_t t = 0; t < same.size(); t++) {
+    callers.emplace_back([&, t] {
+      bool ok = true;
+      for (int round = 0; round < 5; round++) {
+        ok = ok && sameEntries(m.multConcurrent(m, pool), product, 0);
+        ok = ok && sameEntries(m.diamondConcurrent(pool), closure, 0);
+      }
+      same[t] = ok;
+    });
+  }
+  for (auto &c : callers)
+    c.join();
+  for (char ok : same)
+    CHECK(ok);
+
+  return checkResult("ThreadPoolTest");
+}
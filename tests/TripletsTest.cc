@@ -0,0 +1,73 @@
+#include "../lib/Triplets.hpp"
+#include "Check.hpp"
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+// csrFromTriplets against a map built one triplet at a time: duplicate
+// coordinates folded with combine, entries folding to zero dropped, empty
+// rows kept, on and off the pool.
+
+int main() {
+  std::mt19937 rng(4);
+  thread_pool pool(3);
+
+  for (int trial = 0; trial < 20; trial++) {
+    size_t r = 1 + rng() % 300, c = 1 + rng() % 300;
+    size_t m = rng() % 4000;
+    std::vector<Triplet<int>> triplets;
+    std::map<std::pair<size_t, size_t>, int> minOf, sumOf;
+    size_t duplicates = 0;
+    for (size_t k = 0; k < m; k++) {
+      // few distinct coordinates, so most of them repeat
+      Triplet<int> t = {rng() % std::min<size_t>(r, 20),
+                        rng() % std::min<size_t>(c, 20),
+                        int(rng() % 11) - 5};
+      triplets.push_back(t);
+      auto key = std::make_pair(t.row, t.col);
+      if (minOf.count(key)) {
+        duplicates++;
+        minOf[key] = std::min(minOf[key], t.value);
+        sumOf[key] += t.value;
+      } else {
+        minOf[key] = sumOf[key] = t.value;
+      }
+    }
+
+    thread_pool *p = trial % 2 ? &pool : nullptr;
+    size_t merged = 0;
+    CSRMatrix<int> mins = csrFromTriplets(
+        r, c, triplets, [](int x, int y) { return std::min(x, y); }, p,
+        &merged);
+    CSRMatrix<int> sums = csrFromTriplets(
+        r, c, triplets, [](int x, int y) { return x + y; }, p);
+    CHECK(merged == duplicates);
+    CHECK(mins.getNumRows() == r && mins.getNumCols() == c);
+
+    SparseMatrix<int> expectMin(r, c), expectSum(r, c);
+    for (const auto &e : minOf)
+      expectMin.set(e.second, e.first.first, e.first.second);
+    for (const auto &e : sumOf)
+      expectSum.set(e.second, e.first.first, e.first.second);
+    CHECK(sameEntries(mins, expectMin, 0));
+    CHECK(sameEntries(sums, expectSum, 0));
+
+    // no zero survives and every row is sorted without repeats
+    for (size_t i = 0; i < r; i++) {
+      for (size_t q = sums.rowBegin(i); q < sums.rowEnd(i); q++) {
+        CHECK(sums.value(q) != 0);
+        CHECK(q == sums.rowBegin(i) || sums.col(q - 1) < sums.col(q));
+      }
+    }
+  }
+
+  // through SparseMatrix::fromTriplets, whose default sums duplicates
+  std::vector<Triplet<double>> arcs = {
+      {0, 1, 4.0}, {2, 0, 1.5}, {0, 1, 2.5}, {0, 1, 3.0}, {1, 1, 7.0}};
+  SparseMatrix<double> g = SparseMatrix<double>::fromTriplets(3, 3, arcs);
+  CHECK(g.get(0, 1) == 9.5 && g.get(2, 0) == 1.5 && g.get(1, 1) == 7.0);
+  CHECK(g.toCSR().nnz() == 3);
+
+  return checkResult("TripletsTest");
+}